@@ -7,7 +7,6 @@
 #include "C17GH3.h"
 #include "Log.h"
 
-extern Log logger;
 
 void C17GH3State::processRx()
 {
@@ -31,11 +30,13 @@ void C17GH3State::processRx(int byte)
 
 void C17GH3State::processRx(const C17GH3MessageBase& msg)
 {
-	logger.addBytes("RX:", msg.getBytes(), 16);
+	LOG_FRAME(false, msg.getBytes());
+	if (frameCallback)
+		frameCallback(msg.getBytes(), false);
 
 	if (!msg.isValid())
 	{
-		logger.addLine("ERROR: Invalid MSG");
+		LOG_WARN(UART, "Invalid MSG");
 		return;
 	}
 	switch(msg.type)
@@ -47,7 +48,7 @@ void C17GH3State::processRx(const C17GH3MessageBase& msg)
 			if (C17GH3MessageSettings1::WIFI_STATE_CONFIG == s1msg.getWiFiState())
 			{
 				// wifi config request
-				logger.addLine("WIFI CONFIG REQUEST");
+				LOG_INFO(WIFI, "WIFI CONFIG REQUEST");
 				if (wifiConfigCallback)
 				{
 					wifiConfigCallback();
@@ -56,15 +57,23 @@ void C17GH3State::processRx(const C17GH3MessageBase& msg)
 			else
 			{	
 				settings1.setBytes(msg.getBytes());
-				isChanged = true;
-				logger.addLine("Got 0xC1");
+				changedFields |= FIELDS_SETTINGS1 & ~(fieldMask(FIELD_INTERNAL_TEMP) | fieldMask(FIELD_EXTERNAL_TEMP));
+				// the sensors jitter, only report what passes the filters
+				uint32_t millisNow = millis();
+				if (internalTemperature.add(settings1.getInternalTemperature(), millisNow))
+					changedFields |= fieldMask(FIELD_INTERNAL_TEMP);
+				if (externalTemperature.add(settings1.getExternalTemperature(), millisNow))
+					changedFields |= fieldMask(FIELD_EXTERNAL_TEMP);
+				confirmWrite(msg);
+				LOG_DEBUG(UART, "Got 0xC1");
 			}
 		}
 		break;
 		case 0xC2:
 			settings2.setBytes(msg.getBytes());
-			logger.addLine("Got 0xC2");
-			isChanged = true;
+			confirmWrite(msg);
+			LOG_DEBUG(UART, "Got 0xC2");
+			changedFields |= FIELDS_SETTINGS2;
 		break;
 		case 0xC3:
 		case 0xC4:
@@ -74,11 +83,12 @@ void C17GH3State::processRx(const C17GH3MessageBase& msg)
 		case 0xC8:
 		case 0xC9:
 			schedule[msg.type - 0xC3].setBytes(msg.getBytes());
-			logger.addLine("Got 0x" + String(msg.type, HEX));
-			isChanged = true;
+			confirmWrite(msg);
+			LOG_DEBUG(UART, "Got 0x%x", msg.type);
+			changedFields |= fieldMask((Field)(FIELD_SCHEDULE1 + msg.type - 0xC3));
 		break;
 		default:
-			logger.addLine("MSG Not handled");
+			LOG_WARN(UART, "MSG Not handled");
 		break;
 	}
 }
@@ -136,7 +146,7 @@ void C17GH3State::sendSettings1()
 	if ((newWifiState != settings1.getWiFiState()) || (doTimeSend == true))
 	{
 		if (newWifiState != settings1.getWiFiState())
-			logger.addLine(String("Wifi state: ") + String(newWifiState) + String(" Old State:") + String(settings1.getWiFiState()));
+			LOG_INFO(WIFI, "Wifi state: %d Old State:%d", (int)newWifiState, (int)settings1.getWiFiState());
 			
 		doTimeSend = 0;
 		C17GH3MessageSettings1 msg;
@@ -149,7 +159,7 @@ void C17GH3State::sendSettings1()
 		msg.setMinute(minute());
 		msg.pack();
 		sendMessage(msg);
-		logger.addLine(String("Setting Time: Day ") + String(msg.getDayOfWeek()) +  " Time " + String(msg.getHour()) + ":" + String(msg.getMinute()));
+		LOG_DEBUG(UART, "Setting Time: Day %u Time %u:%u", msg.getDayOfWeek(), msg.getHour(), msg.getMinute());
 	}
 }
 
@@ -193,9 +203,164 @@ void C17GH3State::processTx()
 void C17GH3State::sendMessage(const C17GH3MessageBase& msg) const
 {
 	Serial.write(msg.getBytes(), 16);
-	logger.addBytes("TX:", msg.getBytes(), 16);
+	LOG_FRAME(true, msg.getBytes());
+	if (frameCallback)
+		frameCallback(msg.getBytes(), true);
 }
 
+void C17GH3State::printFrame(Print& out, const uint8_t* frame, bool tx)
+{
+	C17GH3MessageBase base(frame);
+	if (!base.isValid())
+		out.print("invalid ");
+	uint8_t type = frame[2];
+	if (C17GH3MessageBase::MSG_TYPE_SETTINGS1 == type)
+	{
+		C17GH3MessageSettings1 msg;
+		msg.setBytes(frame);
+		out.print(msg.toString(tx));
+	}
+	else if (C17GH3MessageBase::MSG_TYPE_SETTINGS2 == type)
+	{
+		C17GH3MessageSettings2 msg;
+		msg.setBytes(frame);
+		out.print(msg.toString());
+	}
+	else if (type >= C17GH3MessageBase::MSG_TYPE_SCHEDULE_DAY1 && type <= C17GH3MessageBase::MSG_TYPE_SCHEDULE_DAY7)
+	{
+		C17GH3MessageSchedule msg;
+		msg.setBytes(frame);
+		out.print(msg.toString());
+	}
+	else if (C17GH3MessageBase::MSG_TYPE_QUERY == type)
+	{
+		C17GH3MessageQuery msg(C17GH3MessageBase::MSG_TYPE_QUERY);
+		msg.setBytes(frame);
+		out.print(msg.toString());
+	}
+	else
+	{
+		out.print(base.toString());
+	}
+}
+
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t len)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+uint32_t C17GH3State::getVersion() const
+{
+	// hashing ~150 bytes is cheaper than tracking every setter, raw temperatures
+	// and the checksum depending on them are left out so sensor noise does not count
+	const uint8_t* s1 = settings1.getBytes();
+	uint32_t hash = fnv1a(2166136261UL, s1, 4);
+	hash = fnv1a(hash, s1 + 8, 7);
+	hash = fnv1a(hash, settings2.getBytes(), 16);
+	for (int i = 0; i < 7; ++i)
+		hash = fnv1a(hash, schedule[i].getBytes(), 16);
+	float temperatures[2] = { getInternalTemperature(), getExternalTemperature() };
+	hash = fnv1a(hash, temperatures, sizeof(temperatures));
+	hash = fnv1a(hash, &isHeating, sizeof(isHeating));
+
+	if (hash != versionHash)
+	{
+		versionHash = hash;
+		++version;
+	}
+	return version;
+}
+
+const char* C17GH3State::getFieldName(Field field)
+{
+	static const char* const names[FIELD_COUNT] = {
+		"wifi",
+		"temperature_setpoint",
+		"lock",
+		"manual",
+		"on",
+		"temperatur_internal",
+		"temperatur_external",
+		"backlight_always_on",
+		"on_after_powerloss",
+		"antifreeze",
+		"sensor_mode",
+		"temperature_correction",
+		"hysteresis_internal",
+		"hysteresis_external",
+		"temperature_limit_external",
+		"schedule1",
+		"schedule2",
+		"schedule3",
+		"schedule4",
+		"schedule5",
+		"schedule6",
+		"schedule7",
+	};
+	if (field >= FIELD_COUNT)
+		return "";
+	return names[field];
+}
+
+String C17GH3State::getFieldValue(Field field) const
+{
+	switch(field)
+	{
+		case FIELD_WIFI:                return String(getWiFiState());
+		case FIELD_SET_POINT_TEMP:      return String(getSetPointTemp());
+		case FIELD_LOCK:                return String(getLock());
+		case FIELD_MODE:                return String(getMode());
+		case FIELD_POWER:               return String(getPower());
+		case FIELD_INTERNAL_TEMP:       return String(getInternalTemperature());
+		case FIELD_EXTERNAL_TEMP:       return String(getExternalTemperature());
+		case FIELD_BACKLIGHT_MODE:      return String(getBacklightMode());
+		case FIELD_POWER_MODE:          return String(getPowerMode());
+		case FIELD_ANTIFREEZE_MODE:     return String(getAntifreezeMode());
+		case FIELD_SENSOR_MODE:         return String(getSensorMode());
+		case FIELD_TEMP_CORRECT:        return String(getTempCorrect());
+		case FIELD_INTERNAL_HYSTERESIS: return String(getInternalHysteresis());
+		case FIELD_EXTERNAL_HYSTERESIS: return String(getExternalHysteresis());
+		case FIELD_TEMPERATURE_LIMIT:   return String(getTemperatureLimit());
+		default:
+			if (field >= FIELD_SCHEDULE1 && field <= FIELD_SCHEDULE7)
+				return getSchedule(field - FIELD_SCHEDULE1 + 1);
+			return String();
+	}
+}
+
+bool C17GH3State::setFieldValue(Field field, const String& value)
+{
+	switch(field)
+	{
+		case FIELD_SET_POINT_TEMP:      setSetPointTemp(value.toFloat()); break;
+		case FIELD_LOCK:                setLock(value.toInt()); break;
+		case FIELD_MODE:                setMode(value.toInt()); break;
+		case FIELD_POWER:               setPower(value.toInt()); break;
+		case FIELD_BACKLIGHT_MODE:      setBacklightMode(value.toInt()); break;
+		case FIELD_POWER_MODE:          setPowerMode(value.toInt()); break;
+		case FIELD_ANTIFREEZE_MODE:     setAntifreezeMode(value.toInt()); break;
+		case FIELD_SENSOR_MODE:         setSensorMode((C17GH3MessageSettings2::SensorMode)value.toInt()); break;
+		case FIELD_TEMP_CORRECT:        setTempCorrect(value.toFloat()); break;
+		case FIELD_INTERNAL_HYSTERESIS: setInternalHysteresis(value.toFloat()); break;
+		case FIELD_EXTERNAL_HYSTERESIS: setExternalHysteresis(value.toFloat()); break;
+		case FIELD_TEMPERATURE_LIMIT:   setTemperatureLimit(value.toFloat()); break;
+		default:
+			if (field >= FIELD_SCHEDULE1 && field <= FIELD_SCHEDULE7)
+			{
+				setSchedule(field - FIELD_SCHEDULE1 + 1, value);
+				break;
+			}
+			return false;
+	}
+	return true;
+}
 
 C17GH3MessageSettings1::WiFiState C17GH3State::getWiFiState() const
 {
@@ -276,14 +441,32 @@ void C17GH3State::setSetPointTemp(float temperature)
 
 float C17GH3State::getInternalTemperature() const
 {
-	return settings1.getInternalTemperature();
+	return internalTemperature.getValue();
 }
 
 float C17GH3State::getExternalTemperature() const
+{
+	return externalTemperature.getValue();
+}
+
+float C17GH3State::getRawInternalTemperature() const
+{
+	return settings1.getInternalTemperature();
+}
+
+float C17GH3State::getRawExternalTemperature() const
 {
 	return settings1.getExternalTemperature();
 }
 
+void C17GH3State::setTemperatureFilter(float deadband, uint32_t maxSilence)
+{
+	internalTemperature.setDeadband(deadband);
+	internalTemperature.setMaxSilence(maxSilence);
+	externalTemperature.setDeadband(deadband);
+	externalTemperature.setMaxSilence(maxSilence);
+}
+
 
 bool C17GH3State::getBacklightMode() const
 {
@@ -406,25 +589,231 @@ String C17GH3State::getSchedule(int day) const
     return ret;
 }
 
-void C17GH3State::setSchedule(int day, String json)
+static bool jsonToBool(const JsonVariant& value, bool& out)
+{
+	if (value.is<bool>())
+		out = value.as<bool>();
+	else if (value.is<int>())
+		out = (0 != value.as<int>());
+	else
+		return false;
+	return true;
+}
+
+static bool jsonToFloat(const JsonVariant& value, float& out)
+{
+	if (!value.is<float>())
+		return false;
+	out = value.as<float>();
+	return true;
+}
+
+bool C17GH3State::setSchedule(int day, const String& json, uint16_t* written)
 {
 	StaticJsonDocument<1024> jsonDoc;
 	
     if ((day < 1) || (day > 7))
-	  return; 
+	  return false;
+	if (!schedule[day - 1].isValid())
+	{
+		LOG_ERROR(UART, "Schedule not yet received from MCU");
+		return false;
+	}
 	C17GH3MessageSchedule s = schedule[day - 1];
 	DeserializationError error = deserializeJson(jsonDoc, json);	
-	if (error)
-	  return;
+	if (error || !jsonDoc.is<JsonObject>())
+	{
+		LOG_ERROR(UART, "Invalid schedule JSON");
+		return false;
+	}
 	for (int i = 0 ; i < 6; ++i)
 	{
-		String time = jsonDoc[String("time" + String(i + 1)).c_str()];
-		float temp = jsonDoc[String("temp" + String(i + 1)).c_str()];
-		int h,m;
-		scanf(time.c_str(),"%d:%d", &h, &m);
-		s.setTime(i, h, m);
-		s.setTemperature(i, temp);
+		JsonVariant time = jsonDoc[String("time" + String(i + 1)).c_str()];
+		JsonVariant temp = jsonDoc[String("temp" + String(i + 1)).c_str()];
+		if (!time.isNull())
+		{
+			int h = -1, m = -1;
+			if (!time.is<const char*>() || 2 != sscanf(time.as<const char*>(), "%d:%d", &h, &m) || h < 0 || h > 23 || m < 0 || m > 59)
+			{
+				LOG_ERROR(UART, "Invalid schedule time%d", i + 1);
+				return false;
+			}
+			s.setTime(i, h, m);
+		}
+		if (!temp.isNull())
+		{
+			float t = 0.f;
+			if (!jsonToFloat(temp, t))
+			{
+				LOG_ERROR(UART, "Invalid schedule temp%d", i + 1);
+				return false;
+			}
+			s.setTemperature(i, t);
+		}
+	}
+	sendWrite(s, written);
+	return true;
+}
+
+bool C17GH3State::setSettings(const String& json, uint16_t* written)
+{
+	StaticJsonDocument<512> jsonDoc;
+
+	DeserializationError error = deserializeJson(jsonDoc, json);
+	if (error || !jsonDoc.is<JsonObject>())
+	{
+		LOG_ERROR(UART, "Invalid settings JSON");
+		return false;
+	}
+
+	C17GH3MessageSettings1 msg1;
+	msg1.setBytes(settings1.getBytes());
+	msg1.setTxFields(false);
+	C17GH3MessageSettings2 msg2;
+	msg2.setBytes(settings2.getBytes());
+	bool hasSettings1 = false;
+	bool hasSettings2 = false;
+
+	// validate every field before anything is sent, a single bad field rejects the whole message
+	JsonObject fields = jsonDoc.as<JsonObject>();
+	for (JsonPair field : fields)
+	{
+		const char* key = field.key().c_str();
+		JsonVariant value = field.value();
+		bool b = false;
+		float f = 0.f;
+		bool valid = true;
+
+		if (!strcmp(key, "on"))
+		{
+			valid = jsonToBool(value, b);
+			msg1.setPower(b);
+			hasSettings1 = true;
+		}
+		else if (!strcmp(key, "lock"))
+		{
+			valid = jsonToBool(value, b);
+			msg1.setLock(b);
+			hasSettings1 = true;
+		}
+		else if (!strcmp(key, "manual"))
+		{
+			valid = jsonToBool(value, b);
+			msg1.setMode(b);
+			hasSettings1 = true;
+		}
+		else if (!strcmp(key, "temperature_setpoint"))
+		{
+			valid = jsonToFloat(value, f);
+			msg1.setSetPointTemp(f);
+			hasSettings1 = true;
+		}
+		else if (!strcmp(key, "backlight_always_on"))
+		{
+			valid = jsonToBool(value, b);
+			msg2.setBacklightMode(b);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "on_after_powerloss"))
+		{
+			valid = jsonToBool(value, b);
+			msg2.setPowerMode(b);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "antifreeze"))
+		{
+			valid = jsonToBool(value, b);
+			msg2.setAntifreezeMode(b);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "sensor_mode"))
+		{
+			int sm = value.as<int>();
+			valid = value.is<int>() && sm >= C17GH3MessageSettings2::SENSOR_MODE_INTERNAL && sm <= C17GH3MessageSettings2::SENSOR_MODE_BOTH;
+			msg2.setSensorMode((C17GH3MessageSettings2::SensorMode)sm);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "temperature_correction"))
+		{
+			valid = jsonToFloat(value, f);
+			msg2.setTemperatureCorrection(f);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "hysteresis_internal"))
+		{
+			valid = jsonToFloat(value, f);
+			msg2.setInternalHysteresis(f);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "hysteresis_external"))
+		{
+			valid = jsonToFloat(value, f);
+			msg2.setExternalHysteresis(f);
+			hasSettings2 = true;
+		}
+		else if (!strcmp(key, "temperature_limit_external"))
+		{
+			valid = jsonToFloat(value, f);
+			msg2.setExternalSensorLimit(f);
+			hasSettings2 = true;
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			LOG_ERROR(UART, "Invalid settings field: %s", key);
+			return false;
+		}
+	}
+
+	// never build a frame on top of a state we have not received from the MCU yet
+	if ((hasSettings1 && !settings1.isValid()) || (hasSettings2 && !settings2.isValid()))
+	{
+		LOG_ERROR(UART, "Settings not yet received from MCU");
+		return false;
+	}
+
+	if (hasSettings1)
+		sendWrite(msg1, written);
+	if (hasSettings2)
+		sendWrite(msg2, written);
+	return true;
+}
+
+void C17GH3State::sendWrite(C17GH3MessageBase& msg, uint16_t* written)
+{
+	msg.pack();
+	sendMessage(msg);
+	uint16_t mask = writeMask(msg.type);
+	memcpy(writtenFrames[msg.type - C17GH3MessageBase::MSG_TYPE_SETTINGS1], msg.getBytes(), 16);
+	unconfirmedWrites |= mask;
+	if (written)
+		*written |= mask;
+}
+
+void C17GH3State::confirmWrite(const C17GH3MessageBase& msg)
+{
+	uint16_t mask = writeMask(msg.type);
+	if (!(unconfirmedWrites & mask))
+		return;
+
+	// bytes the MCU has to report back as written, the others carry its own readings
+	uint16_t checked;
+	if (C17GH3MessageBase::MSG_TYPE_SETTINGS1 == msg.type)
+		checked = (1 << 8) | (1 << 12) | (1 << 13) | (1 << 14);   // set point, lock, mode, power
+	else if (C17GH3MessageBase::MSG_TYPE_SETTINGS2 == msg.type)
+		checked = 0x01F8 | (1 << 10) | (1 << 11);                 // 3-8, sensor mode, sensor limit
+	else
+		checked = 0x7FF8;                                         // all six time/temperature pairs
+
+	const uint8_t* expected = writtenFrames[msg.type - C17GH3MessageBase::MSG_TYPE_SETTINGS1];
+	for (int i = 0; i < 15; ++i)
+	{
+		if ((checked & (1 << i)) && expected[i] != msg.getBytes()[i])
+			return;
 	}
-	s.pack();
-	sendMessage(s);
+	unconfirmedWrites &= ~mask;
 }
@@ -12,6 +12,16 @@ public:
 	{
 		memcpy(bytes,_bytes,16);
 	}
+	// the field references must keep pointing into this object's bytes, so only the bytes are copied
+	C17GH3MessageBase(const C17GH3MessageBase& other)
+	{
+		memcpy(bytes, other.bytes, 16);
+	}
+	C17GH3MessageBase& operator=(const C17GH3MessageBase& other)
+	{
+		memcpy(bytes, other.bytes, 16);
+		return *this;
+	}
 	virtual ~C17GH3MessageBase(){}
 
 	bool operator==(C17GH3MessageBase& other)
@@ -96,6 +106,12 @@ public:
 		type = MSG_TYPE_QUERY;
 		query = (uint8_t)msgType;
 	}
+	C17GH3MessageQuery(const C17GH3MessageQuery& other) : C17GH3MessageBase(other) {}
+	C17GH3MessageQuery& operator=(const C17GH3MessageQuery& other)
+	{
+		C17GH3MessageBase::operator=(other);
+		return *this;
+	}
 	uint8_t &query = bytes[3];
 
 	virtual String toString()
@@ -111,6 +127,12 @@ public:
 	{
 		type = (uint8_t)MSG_TYPE_SETTINGS1;
 	}
+	C17GH3MessageSettings1(const C17GH3MessageSettings1& other) : C17GH3MessageBase(other) {}
+	C17GH3MessageSettings1& operator=(const C17GH3MessageSettings1& other)
+	{
+		C17GH3MessageBase::operator=(other);
+		return *this;
+	}
 
 	virtual String toString(bool sending = false)
 	{
@@ -325,6 +347,12 @@ public:
 	{
 		type = (uint8_t)MSG_TYPE_SETTINGS2;
 	}
+	C17GH3MessageSettings2(const C17GH3MessageSettings2& other) : C17GH3MessageBase(other) {}
+	C17GH3MessageSettings2& operator=(const C17GH3MessageSettings2& other)
+	{
+		C17GH3MessageBase::operator=(other);
+		return *this;
+	}
 	uint8_t &backlightMode       = bytes[3];  // 00 = autooff, ff = steady on
 	uint8_t &powerMode           = bytes[4];  // 00 = off when powered on, ff == last state of power
 	uint8_t &antifreezeMode      = bytes[5];  // 00 = off, ff = on 
@@ -491,6 +519,12 @@ private:
 	String json; 
 public:
 	C17GH3MessageSchedule(){}
+	C17GH3MessageSchedule(const C17GH3MessageSchedule& other) : C17GH3MessageBase(other) {}
+	C17GH3MessageSchedule& operator=(const C17GH3MessageSchedule& other)
+	{
+		C17GH3MessageBase::operator=(other);
+		return *this;
+	}
 	C17GH3MessageSchedule(int day) // day = 0 - 6
 	{
 		type = (uint8_t)MSG_TYPE_SCHEDULE_DAY1 + day;
@@ -640,10 +674,119 @@ private:
 };
 
 
+// median over the last few readings, only reported when it leaves the deadband
+// around the last reported value or the reported value is older than maxSilence
+class C17GH3TemperatureFilter
+{
+public:
+	static const uint8_t SAMPLES = 3;
+
+	bool add(float temperature, uint32_t now)
+	{
+		raw = temperature;
+		samples[nextSample] = temperature;
+		nextSample = (nextSample + 1) % SAMPLES;
+		if (sampleCount < SAMPLES)
+			++sampleCount;
+
+		float filtered = median();
+		if (hasValue && fabsf(filtered - value) < deadband && now - lastReport < maxSilence)
+			return false;
+
+		value = filtered;
+		hasValue = true;
+		lastReport = now;
+		return true;
+	}
+
+	float getValue() const
+	{
+		return value;
+	}
+	float getRaw() const
+	{
+		return raw;
+	}
+
+	void setDeadband(float db)
+	{
+		deadband = db;
+	}
+	void setMaxSilence(uint32_t ms)
+	{
+		maxSilence = ms;
+	}
+
+private:
+	float median() const
+	{
+		float sorted[SAMPLES];
+		memcpy(sorted, samples, sizeof(float) * sampleCount);
+		std::sort(sorted, sorted + sampleCount);
+		return sorted[sampleCount / 2];
+	}
+
+	float samples[SAMPLES] = {0};
+	uint8_t nextSample = 0;
+	uint8_t sampleCount = 0;
+	float raw = 0.f;
+	float value = 0.f;
+	bool hasValue = false;
+	uint32_t lastReport = 0;
+	float deadband = 0.2f;
+	uint32_t maxSilence = 600000;
+};
+
+
 class C17GH3State
 {
 public:
-	bool isChanged = false;
+	// every value published to MQTT, in publish order
+	enum Field
+	{
+		FIELD_WIFI,
+		FIELD_SET_POINT_TEMP,
+		FIELD_LOCK,
+		FIELD_MODE,
+		FIELD_POWER,
+		FIELD_INTERNAL_TEMP,
+		FIELD_EXTERNAL_TEMP,
+		FIELD_BACKLIGHT_MODE,
+		FIELD_POWER_MODE,
+		FIELD_ANTIFREEZE_MODE,
+		FIELD_SENSOR_MODE,
+		FIELD_TEMP_CORRECT,
+		FIELD_INTERNAL_HYSTERESIS,
+		FIELD_EXTERNAL_HYSTERESIS,
+		FIELD_TEMPERATURE_LIMIT,
+		FIELD_SCHEDULE1,
+		FIELD_SCHEDULE7 = FIELD_SCHEDULE1 + 6,
+		FIELD_COUNT
+	};
+
+	static uint32_t fieldMask(Field field)
+	{
+		return 1UL << field;
+	}
+	static const uint32_t FIELDS_SETTINGS1 = (1UL << FIELD_WIFI) | (1UL << FIELD_SET_POINT_TEMP) | (1UL << FIELD_LOCK) | (1UL << FIELD_MODE) |
+	                                         (1UL << FIELD_POWER) | (1UL << FIELD_INTERNAL_TEMP) | (1UL << FIELD_EXTERNAL_TEMP);
+	static const uint32_t FIELDS_SETTINGS2 = (1UL << FIELD_BACKLIGHT_MODE) | (1UL << FIELD_POWER_MODE) | (1UL << FIELD_ANTIFREEZE_MODE) |
+	                                         (1UL << FIELD_SENSOR_MODE) | (1UL << FIELD_TEMP_CORRECT) | (1UL << FIELD_INTERNAL_HYSTERESIS) |
+	                                         (1UL << FIELD_EXTERNAL_HYSTERESIS) | (1UL << FIELD_TEMPERATURE_LIMIT);
+	static const uint32_t FIELDS_ALL = (1UL << FIELD_COUNT) - 1;
+
+	static const char* getFieldName(Field field);
+	String getFieldValue(Field field) const;
+	// MQTT style payload, false for read-only fields
+	bool setFieldValue(Field field, const String& value);
+
+	// fields changed by the MCU since the last call
+	uint32_t takeChangedFields()
+	{
+		uint32_t fields = changedFields;
+		changedFields = 0;
+		return fields;
+	}
 
 	C17GH3MessageSettings1::WiFiState getWiFiState() const;
 	bool getIsHeating() const;
@@ -658,6 +801,9 @@ public:
 	void setSetPointTemp(float temperature);
 	float getInternalTemperature() const;
 	float getExternalTemperature() const;
+	float getRawInternalTemperature() const;
+	float getRawExternalTemperature() const;
+	void setTemperatureFilter(float deadband, uint32_t maxSilence);
 
 	bool getBacklightMode() const;
 	void setBacklightMode(bool bl);
@@ -677,7 +823,22 @@ public:
 	void setTemperatureLimit(float temperature);
 
 	String getSchedule(int day) const;
-	void setSchedule(int day, String json);
+	// any subset of "timeN"/"tempN", the rest of the day is kept
+	bool setSchedule(int day, const String& json, uint16_t* written = nullptr);
+
+	// apply any subset of the Settings1/Settings2 fields with at most one frame per type
+	bool setSettings(const String& json, uint16_t* written = nullptr);
+
+	// bit per frame type Settings1 (C1) to Schedule day 7 (C9)
+	static uint16_t writeMask(uint8_t msgType)
+	{
+		return 1 << (msgType - C17GH3MessageBase::MSG_TYPE_SETTINGS1);
+	}
+	// frames written by setSettings/setSchedule the MCU has not reported back yet
+	uint16_t getUnconfirmedWrites() const
+	{
+		return unconfirmedWrites;
+	}
 
 	//C17GH3State::C17GH3State() {}
 	void processRx();
@@ -686,6 +847,8 @@ public:
 	void processTx();
 	void sendMessage(const C17GH3MessageBase& msg) const;
 	void setTime();
+	// decoded fields of a logged frame, for the log's frame decoder
+	static void printFrame(Print& out, const uint8_t* frame, bool tx);
 
 	typedef std::function<void()> WifiConfigCallback;
 	void setWifiConfigCallback(WifiConfigCallback cb)
@@ -693,41 +856,48 @@ public:
 		wifiConfigCallback = cb;
 	}
 
-	String toString()
+	// every frame received or sent, whatever the log level
+	typedef std::function<void(const uint8_t* frame, bool tx)> FrameCallback;
+	void setFrameCallback(FrameCallback cb)
 	{
-		String str;
-		str += "HEATING: ";
-		if (getIsHeating())
-			str  += "ON\n";
-		else
-			str += "OFF\n";
-		if (settings1.isValid())
-		{
-			str += settings1.toString();
-			str += "\n";
-		}
-		
-		if (settings2.isValid())
-		{
-			str += settings2.toString();
-			str += "\n";
-		}
+		frameCallback = cb;
+	}
+
+	// copy of the values shown on the web pages, taken in one go so a response
+	// sent in several chunks stays consistent while the loop keeps updating
+	struct Snapshot
+	{
+		C17GH3MessageSettings1 settings1;
+		C17GH3MessageSettings2 settings2;
+		C17GH3MessageSchedule schedule[7];
+		bool isHeating = false;
+		float internalTemperature = 0.f;
+		float externalTemperature = 0.f;
+		uint32_t version = 0;
+	};
+
+	void takeSnapshot(Snapshot& snapshot) const
+	{
+		snapshot.settings1.setBytes(settings1.getBytes());
+		snapshot.settings2.setBytes(settings2.getBytes());
 		for (int i = 0; i < 7; ++i)
-		{
-			if (schedule[i].isValid())
-			{
-				str += schedule[i].toString();
-				str += "\n";
-			}
-		}
-		return str;
+			snapshot.schedule[i].setBytes(schedule[i].getBytes());
+		snapshot.isHeating = getIsHeating();
+		snapshot.internalTemperature = getInternalTemperature();
+		snapshot.externalTemperature = getExternalTemperature();
+		snapshot.version = getVersion();
 	}
+
+	// increases whenever anything in a Snapshot changes, except the unfiltered temperatures
+	uint32_t getVersion() const;
 	bool isFirstQueryDone()
 	{
 		return firstQueriesDone;
 	}
 private:
 	bool isValidState(const C17GH3MessageBase::C17GH3MessageType &msgType) const;
+	void sendWrite(C17GH3MessageBase& msg, uint16_t* written);
+	void confirmWrite(const C17GH3MessageBase& msg);
 	void sendSettings1();
 	void sendSettings2() const;
 
@@ -738,9 +908,17 @@ private:
 	C17GH3MessageSchedule schedule[7];
 
 	WifiConfigCallback wifiConfigCallback;
+	FrameCallback frameCallback;
 	mutable bool firstQueriesDone = false;
 	bool isHeating = false;
 	bool doTimeSend = false;
+	uint32_t changedFields = 0;
+	mutable uint32_t version = 1;
+	uint8_t writtenFrames[9][16];
+	uint16_t unconfirmedWrites = 0;
+	mutable uint32_t versionHash = 0;
+	C17GH3TemperatureFilter internalTemperature;
+	C17GH3TemperatureFilter externalTemperature;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "CaptureRing.h"
+#include <LittleFS.h>
+
+#define CAPTURE_HEADER_SIZE 5				// tag and millis
+#define CAPTURE_FRAME_SIZE 16
+
+static void segmentPath(uint32_t number, char* path)
+{
+	sprintf(path, CAPTURE_DIR "/%u", (unsigned)number);
+}
+
+File CaptureRing::openSegment(uint32_t number)
+{
+	char path[24];
+	segmentPath(number, path);
+	return LittleFS.open(path, "r");
+}
+
+bool CaptureRing::mount()
+{
+	// formats an empty partition, which takes a few seconds once
+	if (!mounted)
+		mounted = LittleFS.begin();
+	return mounted;
+}
+
+bool CaptureRing::begin()
+{
+	if (active)
+	{
+		ending = false;
+		return true;
+	}
+	if (!mounted)
+		return false;
+	LittleFS.mkdir(CAPTURE_DIR);
+
+	segmentCount = 0;
+	Dir dir = LittleFS.openDir(CAPTURE_DIR);
+	while (dir.next())
+	{
+		String name = dir.fileName();
+		char* end;
+		uint32_t number = strtoul(name.c_str(), &end, 10);
+		if (name.length() == 0 || *end)
+			continue;
+		if (0 == segmentCount || number < firstSegment)
+			firstSegment = number;
+		if (0 == segmentCount || number > lastSegment)
+		{
+			lastSegment = number;
+			lastSegmentSize = dir.fileSize();
+		}
+		++segmentCount;
+	}
+	if (0 == segmentCount)
+		firstSegment = lastSegment = 0;
+	// a restart continues in a fresh segment, a damaged tail does not hide the new records
+	segmentFull = segmentCount > 0;
+
+	active = true;
+	flushing = false;
+	batchLen = 0;
+	batchRecords = 0;
+	add('B', nullptr, 0);
+	return true;
+}
+
+void CaptureRing::end()
+{
+	if (!active)
+		return;
+	if (exporting)
+	{
+		// the export may still read the segment the flush would remove, update() ends it afterwards
+		ending = true;
+		return;
+	}
+	// a removal, a new segment and the write at most, unless the file system fails
+	for (int i = 0; batchLen > 0 && i < 4; ++i)
+		flush(UINT32_MAX);
+	dropped += batchRecords;
+	batchLen = 0;
+	batchRecords = 0;
+	ending = false;
+	active = false;
+}
+
+void CaptureRing::addFrame(bool tx, const uint8_t* frame)
+{
+	add(tx ? 'T' : 'R', frame, CAPTURE_FRAME_SIZE);
+}
+
+void CaptureRing::addEvent(const char* text, size_t len)
+{
+	add('E', (const uint8_t*)text, std::min<size_t>(len, CAPTURE_EVENT_MAX));
+}
+
+void CaptureRing::add(uint8_t tag, const uint8_t* data, size_t len)
+{
+	if (!active || ending)
+		return;
+	size_t size = CAPTURE_HEADER_SIZE + ('E' == tag ? 1 : 0) + len;
+	if (batchLen + size > sizeof(batch))
+	{
+		++dropped;
+		return;
+	}
+	uint32_t now = millis();
+	if (0 == batchLen)
+		batchStarted = now;
+	uint8_t* p = batch + batchLen;
+	*p++ = tag;
+	memcpy(p, &now, 4);
+	p += 4;
+	if ('E' == tag)
+		*p++ = len;
+	if (len > 0)
+		memcpy(p, data, len);
+	batchLen += size;
+	++batchRecords;
+}
+
+size_t CaptureRing::recordSize(const uint8_t* data, size_t len)
+{
+	if (len < CAPTURE_HEADER_SIZE)
+		return 0;
+	size_t size;
+	switch (data[0])
+	{
+	case 'R':
+	case 'T':
+		size = CAPTURE_HEADER_SIZE + CAPTURE_FRAME_SIZE;
+		break;
+	case 'B':
+		size = CAPTURE_HEADER_SIZE;
+		break;
+	case 'E':
+		if (len < CAPTURE_HEADER_SIZE + 1 || data[CAPTURE_HEADER_SIZE] > CAPTURE_EVENT_MAX)
+			return 0;
+		size = CAPTURE_HEADER_SIZE + 1 + data[CAPTURE_HEADER_SIZE];
+		break;
+	default:
+		return 0;
+	}
+	return size <= len ? size : 0;
+}
+
+size_t CaptureRing::readRecord(File& file, uint8_t* record)
+{
+	size_t len = file.read(record, CAPTURE_HEADER_SIZE);
+	if (CAPTURE_HEADER_SIZE != len)
+		return 0;
+	if ('E' == record[0])
+	{
+		if (1 != file.read(record + len, 1))
+			return 0;
+		++len;
+		if (record[CAPTURE_HEADER_SIZE] <= CAPTURE_EVENT_MAX)
+			len += file.read(record + len, record[CAPTURE_HEADER_SIZE]);
+	}
+	else if ('R' == record[0] || 'T' == record[0])
+	{
+		len += file.read(record + len, CAPTURE_FRAME_SIZE);
+	}
+	return recordSize(record, len);
+}
+
+void CaptureRing::update()
+{
+	if (ending && !exporting)
+	{
+		end();
+		return;
+	}
+	if (!active || exporting || 0 == batchLen)
+		return;
+	if (!flushing && batchLen < CAPTURE_FLUSH_BYTES && (int32_t)(millis() - batchStarted) < CAPTURE_FLUSH_MS)
+		return;
+	flushing = true;
+	uint32_t started = micros();
+	flush(CAPTURE_WRITE_BUDGET_US);
+	flushMaxMicros = std::max<uint32_t>(flushMaxMicros, micros() - started);
+}
+
+void CaptureRing::flush(uint32_t budgetUs)
+{
+	uint32_t started = micros();
+	char path[24];
+
+	// one file operation per pass at most, each of them may erase a block
+	if (segmentFull || 0 == segmentCount)
+	{
+		if (segmentCount >= CAPTURE_SEGMENTS)
+		{
+			// one that cannot be removed is left behind instead of blocking the ring, begin() counts it again
+			segmentPath(firstSegment++, path);
+			LittleFS.remove(path);
+			--segmentCount;
+			return;
+		}
+		if (segmentCount > 0)
+			++lastSegment;
+		++segmentCount;
+		lastSegmentSize = 0;
+		segmentFull = false;
+	}
+
+	segmentPath(lastSegment, path);
+	File file = LittleFS.open(path, "a");
+	if (!file)
+	{
+		dropped += batchRecords;
+		batchLen = 0;
+		batchRecords = 0;
+		flushing = false;
+		return;
+	}
+	size_t written = 0;
+	while (written < batchLen)
+	{
+		size_t size = recordSize(batch + written, batchLen - written);
+		if (lastSegmentSize + size > CAPTURE_SEGMENT_SIZE)
+		{
+			segmentFull = true;
+			break;
+		}
+		if (file.write(batch + written, size) != size)
+		{
+			// most likely out of space, start over in the next segment
+			segmentFull = true;
+			break;
+		}
+		written += size;
+		lastSegmentSize += size;
+		--batchRecords;
+		if (micros() - started >= budgetUs)
+			break;
+	}
+	file.close();
+
+	memmove(batch, batch + written, batchLen - written);
+	batchLen -= written;
+	if (0 == batchLen)
+		flushing = false;
+}
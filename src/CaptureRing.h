@@ -0,0 +1,102 @@
+#ifndef CAPTURERING_H
+#define CAPTURERING_H
+#include <Arduino.h>
+#include <FS.h>
+
+// UART frames and log events kept in flash, so an overnight problem can still
+// be looked at after the RAM log wrapped or the device restarted.
+//
+// Records collect in a RAM batch and are appended from loop() to segment files
+// /capture/<n> on LittleFS once CAPTURE_FLUSH_BYTES are waiting or the oldest
+// waited CAPTURE_FLUSH_MS. When the newest segment is full the next one is
+// started and the oldest removed, so the ring is bounded and the erases move
+// over the whole file system instead of rewriting the same blocks. A record
+// that does not fit the batch is dropped.
+//
+// A pass stops writing records once CAPTURE_WRITE_BUDGET_US passed since it
+// started, counting the open. The open or a removal, the first record and the
+// close are done whatever the budget, and each of them may erase a 4 KB block
+// (20-50 ms on the usual flash chips), so a pass is typically 1-3 ms but can
+// reach about 100 ms. The longest pass, open and close included, is reported
+// by getFlushMaxMicros().
+//
+// LittleFS is only mounted from setup(): an empty or damaged partition is
+// formatted then, which takes seconds and must not happen in loop().
+//
+// Record: tag, uint32 millis little endian, then
+//   'R' / 'T'  16 frame bytes, received / sent
+//   'E'        uint8 length and the text of a log event
+//   'B'        nothing, the device started
+#define CAPTURE_DIR "/capture"
+#define CAPTURE_SEGMENT_SIZE 16384
+#define CAPTURE_SEGMENTS 8                // 128 KB of flash, about 6000 frames
+#define CAPTURE_BATCH_SIZE 1024
+#define CAPTURE_FLUSH_BYTES 512
+#define CAPTURE_FLUSH_MS 60000
+#define CAPTURE_WRITE_BUDGET_US 2000      // see above for what it does not cover
+#define CAPTURE_EVENT_MAX 120             // longer events are cut
+#define CAPTURE_RECORD_MAX (5 + 1 + CAPTURE_EVENT_MAX)
+
+class CaptureRing
+{
+public:
+	// mounts LittleFS, formatting it when needed; only from setup()
+	bool mount();
+	// continues after the newest segment, false when the file system is not mounted
+	bool begin();
+	// writes the batch and stops recording, the segments can still be exported;
+	// during an export no more records are taken and the rest waits for update()
+	void end();
+	bool isActive() const { return active; }
+	bool isMounted() const { return mounted; }
+
+	void addFrame(bool tx, const uint8_t* frame);
+	void addEvent(const char* text, size_t len);
+	// writes batched records while the time budget lasts, call from loop()
+	void update();
+
+	// no segment is written or removed while an export reads them
+	void beginExport() { ++exporting; }
+	void endExport() { --exporting; }
+	uint32_t getFirstSegment() const { return firstSegment; }
+	uint32_t getLastSegment() const { return lastSegment; }
+	bool hasSegments() const { return segmentCount > 0; }
+	static File openSegment(uint32_t number);
+	// the next record of a segment into record (CAPTURE_RECORD_MAX bytes), its size; 0 at the end or on a damaged record
+	static size_t readRecord(File& file, uint8_t* record);
+	// the records not written yet; while exporting they are only appended to
+	const uint8_t* getBatch(size_t& len) const
+	{
+		len = batchLen;
+		return batch;
+	}
+	// size of the complete record at the start of data, 0 if there is none
+	static size_t recordSize(const uint8_t* data, size_t len);
+
+	uint32_t getDropped() const { return dropped; }
+	uint32_t getFlushMaxMicros() const { return flushMaxMicros; }
+
+private:
+	void add(uint8_t tag, const uint8_t* data, size_t len);
+	// writes records until the batch is empty or budgetUs passed
+	void flush(uint32_t budgetUs);
+
+	bool mounted = false;
+	bool active = false;
+	bool ending = false;				// end() waits for the export
+	bool flushing = false;
+	uint8_t exporting = 0;
+	uint32_t firstSegment = 0;
+	uint32_t lastSegment = 0;			// the one being appended to
+	uint8_t segmentCount = 0;
+	size_t lastSegmentSize = 0;
+	bool segmentFull = false;
+
+	uint8_t batch[CAPTURE_BATCH_SIZE];
+	size_t batchLen = 0;
+	uint16_t batchRecords = 0;
+	uint32_t batchStarted = 0;			// millis() of the oldest record waiting
+	uint32_t dropped = 0;				// records
+	uint32_t flushMaxMicros = 0;		// longest update() pass that wrote
+};
+#endif
@@ -0,0 +1,62 @@
+#include "ChunkedResponse.h"
+#include <memory>
+
+size_t ChunkedResponse::write(uint8_t c)
+{
+	pending += (char)c;
+	return 1;
+}
+
+size_t ChunkedResponse::write(const uint8_t* data, size_t size)
+{
+	pending.concat((const char*)data, size);
+	return size;
+}
+
+AsyncWebServerResponse* ChunkedResponse::begin(AsyncWebServerRequest* request, const char* contentType, ChunkedResponse* body)
+{
+	std::shared_ptr<ChunkedResponse> owner(body);
+	return request->beginChunkedResponse(contentType, [owner](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+		return owner->fill(buffer, maxLen);
+	});
+}
+
+size_t ChunkedResponse::fill(uint8_t* buffer, size_t maxLen)
+{
+	size_t len = 0;
+	while (len < maxLen)
+	{
+		if (pendingPos == pending.length())
+		{
+			if (done)
+				break;
+			pending = "";
+			pendingPos = 0;
+			done = !next();
+			continue;
+		}
+		size_t n = std::min(maxLen - len, pending.length() - pendingPos);
+		memcpy(buffer + len, pending.c_str() + pendingPos, n);
+		pendingPos += n;
+		len += n;
+	}
+	return len;	// 0 ends the response
+}
+
+void printJsonString(Print& out, const char* s)
+{
+	out.print('"');
+	for (; *s; ++s)
+	{
+		if ('"' == *s || '\\' == *s)
+		{
+			out.print('\\');
+			out.print(*s);
+		}
+		else if ((uint8_t)*s < 0x20)
+			out.printf("\\u%04x", (unsigned)(uint8_t)*s);
+		else
+			out.print(*s);
+	}
+	out.print('"');
+}
@@ -0,0 +1,52 @@
+#ifndef CHUNKEDRESPONSE_H
+#define CHUNKEDRESPONSE_H
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Response body produced piece by piece from the async server's chunk callback.
+// Subclasses print one piece (a page fragment, a log line, a state message) per
+// call of next(), so the heap used per request is bounded by the largest piece
+// and does not depend on the response size.
+class ChunkedResponse : public Print
+{
+public:
+	virtual ~ChunkedResponse() {}
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* data, size_t size) override;
+	using Print::write;
+
+	// response streaming body, which it takes ownership of; add headers and pass it to request->send()
+	static AsyncWebServerResponse* begin(AsyncWebServerRequest* request, const char* contentType, ChunkedResponse* body);
+	static void send(AsyncWebServerRequest* request, const char* contentType, ChunkedResponse* body)
+	{
+		request->send(begin(request, contentType, body));
+	}
+
+protected:
+	// print the following piece, false after the last one
+	virtual bool next() = 0;
+
+private:
+	size_t fill(uint8_t* buffer, size_t maxLen);
+
+	String pending;
+	size_t pendingPos = 0;
+	bool done = false;
+};
+
+// s as a quoted JSON string
+void printJsonString(Print& out, const char* s);
+
+// one "id|value|kind" line as parsed by setValues() in microajax.js
+template <typename T>
+void printValue(Print& out, const char* id, const T& value, const char* kind)
+{
+	out.print(id);
+	out.print('|');
+	out.print(value);
+	out.print('|');
+	out.print(kind);
+	out.print('\n');
+}
+#endif
@@ -7,17 +7,27 @@
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
 #include <DNSServer.h>
-#include <ESP8266WebServer.h>
-#include <ESP8266HTTPUpdateServer.h>
+#include <ESPAsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <Updater.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
 #include <Ticker.h>
 #include <EEPROM.h>
+#include <ArduinoJson.h>
 
 #include "C17GH3.h"
+#include "CaptureRing.h"
+#include "SyslogSink.h"
+#include "ChunkedResponse.h"
+#include "WebPush.h"
+#include "WifiScan.h"
+#include "FrameInjector.h"
 #include "Log.h"
 
-extern Log logger;
+#define HTTP_COMMAND_QUEUE_SIZE 4         // console commands waiting for loop()
+#define HTTP_API_CONFIRM_MS 2000          // wait this long for the MCU to report a write back
+#define HTTP_INJECT_INTERVAL_MS 20        // /api/inject default gap between frames
 
 class ESPBASE
 {
@@ -26,25 +36,66 @@ public:
     void initialize(C17GH3State* s);
     void httpSetup();
     void OTASetup();
+    // work the request handlers left for the control loop, call from loop()
+    void handle();
+    // called from handle() with the CONFIG_CHANGED_* bits of a saved config that did not need a restart
+    void setConfigChangedCallback(std::function<void(uint8_t)> callback)
+    {
+      configChangedCallback = callback;
+    }
 private:
-	  void handleConsole();
-    void handleStatus();
+	  void handleConsole(AsyncWebServerRequest* request);
+    void handleStatus(AsyncWebServerRequest* request);
+    void handleApiState(AsyncWebServerRequest* request);
+    void handleApiLog(AsyncWebServerRequest* request);
+    void handleApiCapture(AsyncWebServerRequest* request);
+    void handleApiWrite(AsyncWebServerRequest* request);
+    void handleApiWritePending();
+    void handleInject(AsyncWebServerRequest* request);
+    void handleInjectBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+    void finishApiWrite(int code, const char* json);
+    void handleUpdateUpload(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final);
+    void applyConsoleCommand(String cmd);
+    void applyLogLevelCommand(const char* cmd);
+    void applyConfig(uint8_t changed);
 
-    ESP8266HTTPUpdateServer httpUpdater; 
     class C17GH3State* state = nullptr;
+    String consoleCommands[HTTP_COMMAND_QUEUE_SIZE];
+    uint8_t consoleCommandFirst = 0;
+    uint8_t consoleCommandCount = 0;
+    bool updateDone = false;
+    uint32_t bootId = 0;                  // keeps ETags of different boots apart
+    std::function<void(uint8_t)> configChangedCallback;
+    FrameInjector injector;
+    AsyncWebServerRequest* injectRequest = nullptr;   // the batch being injected, null once its client went away
+    bool injectAckPending = false;                    // body data not acknowledged to hold the sender back
+
+    // one settings/schedule write at a time, answered from handle() once the MCU confirmed it
+    struct ApiWrite
+    {
+      AsyncWebServerRequest* request = nullptr;   // null once the client went away
+      String json;
+      int day = 0;                                // 0 = settings, 1..7 = schedule day
+      uint16_t waiting = 0;                       // C17GH3State::writeMask bits not confirmed yet
+      uint32_t deadline = 0;
+      bool active = false;
+      bool sent = false;
+    } apiWrite;
 };
 
 #include "Parameters.h"
 #include "WifiTools.h"
 
 #include "C17GH3.h"
+// gzipped copies of the pages below, generated by tools/compress_assets.py
+#include "Assets_gz.h"
 // Include the HTML, STYLE and Script "Pages"
 #include "Page_Admin.h"
 #include "Page_Script.js.h"
 #include "Page_Style.css.h"
-#include "Page_NTPsettings.h"
 #include "Page_Information.h"
-#include "Page_General.h"
+#include "Page_Console.h"
+#include "Page_Configuration.h"
 #include "PAGE_NetworkConfiguration.h"
 
 void ESPBASE::initialize(C17GH3State* s)
@@ -55,10 +106,11 @@ void ESPBASE::initialize(C17GH3State* s)
   uint8_t timeoutClick = 50;
   
   state = s;
+  bootId = random(0x7FFFFFFF);
 
   String chipID;
 
-  EEPROM.begin(512); // define an EEPROM space of 512Bytes to store data
+  EEPROM.begin(CONFIG_EEPROM_SIZE); // the config blob lives in the first bytes
 
   //**** Network Config load
   CFG_saved = ReadConfig();
@@ -73,7 +125,7 @@ void ESPBASE::initialize(C17GH3State* s)
       WiFi.mode(WIFI_STA);
       WiFi.setAutoReconnect(true);
       WiFi.hostname(config.DeviceName);
-      WiFi.begin(config.ssid.c_str(), config.password.c_str());
+      WiFi.begin(config.ssid, config.password);
       while((WiFi.status()!= WL_CONNECTED) and --timeoutClick > 0) {
         delay(500);
       }
@@ -92,217 +144,818 @@ void ESPBASE::initialize(C17GH3State* s)
     //load config with default values
     configLoadDefaults(getChipId());
     WiFi.mode(WIFI_AP);
-    WiFi.softAP(config.ssid.c_str());
+    WiFi.softAP(config.ssid);
   }
 
   //  Http Setup
   httpSetup();
 
+  state->setFrameCallback([](const uint8_t* frame, bool tx) {
+    capture.addFrame(tx, frame);
+  });
+  // mounted even with the capture off, so it can be turned on without a restart
+  if (!capture.mount())
+    LOG_ERROR(SYS, "Capture: no file system");
+  else if (config.capture_flash)
+    capture.begin();
+  syslogSink.begin(IPAddress(config.syslog_server[0], config.syslog_server[1], config.syslog_server[2], config.syslog_server[3]),
+                   config.syslog_port, config.DeviceName);
+
   // ***********  OTA SETUP
   OTASetup();
 
 }
 
+const char PAGE_UpdateForm[] PROGMEM = R"=====(<html><body><form method='POST' action='' enctype='multipart/form-data'>
+<input type='file' name='update'><input type='submit' value='Update'>
+</form></body></html>)=====";
+
 void ESPBASE::httpSetup()
 {
   // Start HTTP Server for configuration
-  server.on ( "/", []() {
-    if(config.OTApwd.length() > 0)
-	  {
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	  }
-    server.send_P ( 200, "text/html", PAGE_AdminMainPage);  // const char top of page
+  server.on ( "/", [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    SEND_GZIP_ASSET ( request, PAGE_AdminMainPage, "text/html", CACHE_PAGE );  // const char top of page
+  }  );
+  server.on ( "/favicon.ico",   [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    request->send( 200, "text/html", "" );
   }  );
-  server.on ( "/favicon.ico",   []() {
-    if(config.OTApwd.length() > 0)
-	  {
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	  }
-    server.send( 200, "text/html", "" );
+  // all settings on one page, the old page names lead there
+  server.on ( "/config.html", [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    SEND_GZIP_ASSET ( request, PAGE_Configuration, "text/html", CACHE_PAGE );
   }  );
-  // Network config
-  server.on ( "/config.html", send_network_configuration_html );
+  server.on ( "/general.html", [](AsyncWebServerRequest* request) { request->redirect("/config.html#general"); } );
+  server.on ( "/ntp.html", [](AsyncWebServerRequest* request) { request->redirect("/config.html#ntp"); } );
   // Info Page
-  server.on ( "/info.html", []() {
-    if(config.OTApwd.length() > 0)
-	  {
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	  }
-    server.send_P ( 200, "text/html", PAGE_Information );
+  server.on ( "/info.html", [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    SEND_GZIP_ASSET ( request, PAGE_Information, "text/html", CACHE_PAGE );
   }  );
-  server.on ( "/ntp.html", send_NTP_configuration_html  );
 
   //server.on ( "/appl.html", send_application_configuration_html  );
-  server.on ( "/general.html", send_general_html  );
-  //  server.on ( "/example.html", []() { server.send_P ( 200, "text/html", PAGE_EXAMPLE );  } );
-  server.on ( "/style.css", []() {
-    if(config.OTApwd.length() > 0)
-	  {
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	  }
-    server.send_P ( 200, "text/plain", PAGE_Style_css );
+  //  server.on ( "/example.html", [](AsyncWebServerRequest* request) { request->send_P ( 200, "text/html", PAGE_EXAMPLE );  } );
+  server.on ( "/style.css", [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    SEND_GZIP_ASSET ( request, PAGE_Style_css, "text/css", CACHE_STATIC );
   } );
-  server.on ( "/microajax.js", []() {
-    if(config.OTApwd.length() > 0)
-	  {
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	  }
-    server.send_P ( 200, "text/plain", PAGE_microajax_js );
+  server.on ( "/microajax.js", [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    SEND_GZIP_ASSET ( request, PAGE_microajax_js, "application/javascript", CACHE_STATIC );
   } );
-  server.on ( "/admin/values", send_network_configuration_values_html );
   server.on ( "/admin/connectionstate", send_connection_state_values_html );
   server.on ( "/admin/infovalues", send_information_values_html );
-  server.on ( "/admin/ntpvalues", send_NTP_configuration_values_html );
-  server.on ( "/admin/generalvalues", send_general_configuration_values_html);
-  server.on ( "/admin/devicename",     send_devicename_value_html);
-	server.on("/status", HTTP_GET,std::bind(&ESPBASE::handleStatus, this));
-	server.on("/console", HTTP_GET,std::bind(&ESPBASE::handleConsole, this));
-	server.on("/console", HTTP_POST,std::bind(&ESPBASE::handleConsole, this));
-  server.onNotFound ( []() {
-    server.send ( 400, "text/html", "Page not Found" );
+  server.on ( "/api/config", HTTP_GET, send_config_json );
+  server.on ( "/api/config", HTTP_POST, receive_config_json, nullptr, httpCollectBody );
+	server.on("/status", HTTP_GET, std::bind(&ESPBASE::handleStatus, this, std::placeholders::_1));
+	server.on("/api/state", HTTP_GET, std::bind(&ESPBASE::handleApiState, this, std::placeholders::_1));
+	server.on("/api/log", HTTP_GET, std::bind(&ESPBASE::handleApiLog, this, std::placeholders::_1));
+	server.on("/api/capture", HTTP_GET, std::bind(&ESPBASE::handleApiCapture, this, std::placeholders::_1));
+	// /api/schedule also takes /api/schedule/<day>
+	server.on("/api/settings", HTTP_POST, std::bind(&ESPBASE::handleApiWrite, this, std::placeholders::_1), nullptr,
+	          httpCollectBody);
+	server.on("/api/schedule", HTTP_POST, std::bind(&ESPBASE::handleApiWrite, this, std::placeholders::_1), nullptr,
+	          httpCollectBody);
+	server.on("/api/inject", HTTP_POST, std::bind(&ESPBASE::handleInject, this, std::placeholders::_1), nullptr,
+	          std::bind(&ESPBASE::handleInjectBody, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3,
+	                    std::placeholders::_4, std::placeholders::_5));
+	server.on("/console", HTTP_GET | HTTP_POST, std::bind(&ESPBASE::handleConsole, this, std::placeholders::_1));
+  server.on ( "/update", HTTP_GET, [](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    request->send_P ( 200, "text/html", PAGE_UpdateForm );
+  } );
+  server.on ( "/update", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    if (!httpAuthenticate(request))
+      return;
+    request->send ( 200, "text/html", updateDone ? "Update Success! Rebooting..." : "Update Failed" );
+    if (updateDone)
+      httpRestartAt = millis() + 1000;
+  }, std::bind(&ESPBASE::handleUpdateUpload, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3,
+               std::placeholders::_4, std::placeholders::_5, std::placeholders::_6) );
+  if(config.OTApwd[0])
+  {
+    ws.setAuthentication("admin", config.OTApwd);
+  }
+  webPush.begin();
+  server.addHandler(&ws);
+  logger.setLineCallback([](const Log::Line& line) {
+    webPush.pushLogLine(line);
+    if (Log::KIND_TEXT == line.kind && line.level <= LOG_LEVEL_INFO)
+      capture.addEvent(line.text, line.length);
+  });
+  logger.setFrameDecoder(C17GH3State::printFrame);
+
+  server.onNotFound ( [](AsyncWebServerRequest* request) {
+    request->send ( 400, "text/html", "Page not Found" );
   }  );
 
-  if(config.OTApwd.length() > 0)
+  server.begin();
+  return;
+}
+
+void ESPBASE::handle()
+{
+  wifiScan.update();
+  ws.cleanupClients(WEB_PUSH_MAX_CLIENTS);
+  capture.update();
+  syslogSink.update();
+
+  while (consoleCommandCount > 0)
   {
-    httpUpdater.setup(&server, "/update", "admin", config.OTApwd);
+    applyConsoleCommand(consoleCommands[consoleCommandFirst]);
+    consoleCommands[consoleCommandFirst] = String();
+    consoleCommandFirst = (consoleCommandFirst + 1) % HTTP_COMMAND_QUEUE_SIZE;
+    --consoleCommandCount;
   }
-  else
+
+  if (apiWrite.active)
+    handleApiWritePending();
+
+  if (injector.isActive())
   {
-    httpUpdater.setup(&server, "/update");
+    injector.update(*state);
+    if (injectAckPending && 0 == injector.getQueued())
+    {
+      injectAckPending = false;
+      if (injectRequest)
+        injectRequest->client()->ack(SIZE_MAX);   // clamped to what was held back
+    }
+    if (injector.isDone())
+    {
+      if (injectRequest)
+      {
+        char json[80];
+        snprintf(json, sizeof(json), "{\"processed\":%u,\"rejected\":%u,\"coalesced\":%u}",
+                 injector.getProcessed(), injector.getRejected(), injector.getCoalesced());
+        injectRequest->send(200, "application/json", json);
+      }
+      LOG_INFO(HTTP, "Injected: %u, rejected: %u, coalesced: %u", injector.getProcessed(), injector.getRejected(),
+               injector.getCoalesced());
+      injectRequest = nullptr;
+      injector.finish();
+    }
   }
 
-  server.begin();
-  return;
+  if (httpConfigSavePending)
+  {
+    httpConfigSavePending = false;
+    WriteConfig();
+  }
+
+  if (httpConfigChanged)
+  {
+    uint8_t changed = httpConfigChanged;
+    httpConfigChanged = 0;
+    applyConfig(changed);
+  }
+
+  if (httpRestartAt != 0 && (int32_t)(millis() - httpRestartAt) >= 0)
+    ESP.restart();
 }
 
-void ESPBASE::handleStatus()
+// the parts ESPBASE owns, the application gets the rest through the callback
+void ESPBASE::applyConfig(uint8_t changed)
 {
-	String header;
-	if(config.OTApwd.length() > 0)
-	{
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	}
+  if (changed & CONFIG_CHANGED_PASSWORD)
+    ws.setAuthentication("admin", config.OTApwd);    // an empty password turns it off
+  if (changed & CONFIG_CHANGED_NAME)
+  {
+    WiFi.hostname(config.DeviceName);
+    MDNS.setHostname(config.DeviceName);
+  }
+  if (changed & (CONFIG_CHANGED_SYSLOG | CONFIG_CHANGED_NAME))
+    syslogSink.begin(IPAddress(config.syslog_server[0], config.syslog_server[1], config.syslog_server[2], config.syslog_server[3]),
+                     config.syslog_port, config.DeviceName);
+  if (changed & CONFIG_CHANGED_CAPTURE)
+  {
+    if (!config.capture_flash)
+      capture.end();
+    else if (!capture.begin())
+      LOG_ERROR(SYS, "Capture: no file system");
+  }
+  LOG_INFO(SYS, "Config applied: %x", changed);
+  if (configChangedCallback)
+    configChangedCallback(changed);
+}
+
+void ESPBASE::handleUpdateUpload(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final)
+{
+  if (0 == index)
+  {
+    updateDone = false;
+    if (config.OTApwd[0] && !request->authenticate("admin", config.OTApwd))
+      return;
+    LOG_INFO(HTTP, "Update: %s", filename.c_str());
+    Update.runAsync(true);
+    if (!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000))
+      return;
+  }
+  if (!Update.isRunning())
+    return;
+  if (Update.write(data, len) != len)
+    return;
+  if (final)
+  {
+    updateDone = Update.end(true);
+    if (updateDone)
+      LOG_INFO(HTTP, "Update done: %u bytes", (unsigned)(index + len));
+    else
+      LOG_ERROR(HTTP, "Update failed");
+  }
+}
 
-	String msg( R"=====(
+const char STATUS_Header[] PROGMEM = R"=====(
   <meta name="viewport" content="width=device-width, initial-scale=1" />
   <meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
   <a href="/"  class="btn btn--s"><</a>&nbsp;&nbsp;<strong>State</strong>
   <hr>
-  )=====");
+  )=====";
 
-  msg += "<p>Day: " + String(weekday() == 1 ? 7 : weekday() - 1) + " Hour: " + String(hour()) + " Minute: " + String(minute()) + "</p>";
-	msg += "<pre>";
-	msg += state->toString();
-	msg += "</pre>";
-	
-	msg += String(R"=====(
-  <script>
-  window.onload = function ()
-  {
-	  load("style.css","css", function() 
-	  {
-		  load("microajax.js","js", function() 
-		  {
-				setValues("/admin/generalvalues");
-		  });
-	  });
-  }
-  function load(e,t,n){if("js"==t){var a=document.createElement("script");a.src=e,a.type="text/javascript",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}else if("css"==t){var a=document.createElement("link");a.href=e,a.rel="stylesheet",a.type="text/css",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}}
-  </script>
-)=====" );
-	server.send(200, "text/html", msg);
+const char PAGE_LoadStyle[] PROGMEM = R"=====(
+  <link rel="stylesheet" href="style.css" type="text/css" />
+)=====";
+
+// /status from a state snapshot, one message per chunk
+class StatusResponse : public ChunkedResponse
+{
+public:
+	StatusResponse(const C17GH3State& state)
+	{
+		state.takeSnapshot(snapshot);
+	}
+
+protected:
+	bool next() override
+	{
+		int piece = step++;
+		switch (piece)
+		{
+		case 0:
+			print(FPSTR(STATUS_Header));
+			printf("<p>Day: %d Hour: %d Minute: %d</p>", weekday() == 1 ? 7 : weekday() - 1, hour(), minute());
+			print("<pre>");
+			print(snapshot.isHeating ? "HEATING: ON\n" : "HEATING: OFF\n");
+			print("Filtered: internal temp: ");
+			print(snapshot.internalTemperature);
+			print(", external temp: ");
+			print(snapshot.externalTemperature);
+			print('\n');
+			return true;
+		case 1:
+			printMessage(snapshot.settings1);
+			return true;
+		case 2:
+			printMessage(snapshot.settings2);
+			return true;
+		case 10:
+			print("</pre>");
+			print(FPSTR(PAGE_LoadStyle));
+			return false;
+		default:
+			printMessage(snapshot.schedule[piece - 3]);
+			return true;
+		}
+	}
+
+private:
+	void printMessage(C17GH3MessageBase& msg)
+	{
+		if (msg.isValid())
+		{
+			print(msg.toString());
+			print('\n');
+		}
+	}
+
+	C17GH3State::Snapshot snapshot;
+	int step = 0;
+};
+
+// /api/state, same field names as the MQTT topics and the settings JSON
+class StateJsonResponse : public ChunkedResponse
+{
+public:
+	StateJsonResponse(const C17GH3State& state)
+	{
+		state.takeSnapshot(snapshot);
+	}
+
+protected:
+	bool next() override
+	{
+		int piece = step++;
+		if (0 == piece)
+		{
+			printf("{\"version\":%u,\"heating\":%s,\"temperature_internal\":", (unsigned)snapshot.version, snapshot.isHeating ? "true" : "false");
+			print(snapshot.internalTemperature);
+			print(",\"temperature_external\":");
+			print(snapshot.externalTemperature);
+			print(",\"settings1\":");
+			C17GH3MessageSettings1& s1 = snapshot.settings1;
+			if (!s1.isValid())
+			{
+				print("null");
+				return true;
+			}
+			printf("{\"wifi\":%d,\"on\":%s,\"lock\":%s,\"manual\":%s,\"temperature_setpoint\":", s1.getWiFiState(),
+			       boolString(s1.getPower()), boolString(s1.getLock()), boolString(s1.getMode()));
+			print(s1.getSetPointTemp());
+			print('}');
+			return true;
+		}
+		if (1 == piece)
+		{
+			print(",\"settings2\":");
+			C17GH3MessageSettings2& s2 = snapshot.settings2;
+			if (!s2.isValid())
+			{
+				print("null");
+				return true;
+			}
+			printf("{\"backlight_always_on\":%s,\"on_after_powerloss\":%s,\"antifreeze\":%s,\"sensor_mode\":%d,\"temperature_correction\":",
+			       boolString(s2.getBacklightMode()), boolString(s2.getPowerMode()), boolString(s2.getAntifreezeMode()), s2.getSensorMode());
+			print(s2.getTemperatureCorrection());
+			print(",\"hysteresis_internal\":");
+			print(s2.getInternalHysteresis());
+			print(",\"hysteresis_external\":");
+			print(s2.getExternalHysteresis());
+			printf(",\"temperature_limit_external\":%d}", s2.getExternalSensorLimit());
+			return true;
+		}
+		if (piece < 9)
+		{
+			C17GH3MessageSchedule& day = snapshot.schedule[piece - 2];
+			print(2 == piece ? ",\"schedule\":[" : ",");
+			if (day.isValid())
+				print(day.toJson());
+			else
+				print("null");
+			return true;
+		}
+		print("]}");
+		return false;
+	}
+
+private:
+	static const char* boolString(bool b)
+	{
+		return b ? "true" : "false";
+	}
+
+	C17GH3State::Snapshot snapshot;
+	int step = 0;
+};
+
+// /api/log: the cursor for the next call, then the lines from since on, one line per chunk;
+// frames are formatted here, with their decoded fields when asked for
+class LogResponse : public ChunkedResponse
+{
+public:
+	LogResponse(uint32_t since, bool decode) : nextLine(since), endLine(logger.getNextId()), decode(decode) {}
+
+protected:
+	bool next() override
+	{
+		if (!started)
+		{
+			started = true;
+			printf("%u\n", (unsigned)endLine);
+			return true;
+		}
+		return logger.printLine(*this, nextLine, endLine, decode);
+	}
+
+private:
+	bool started = false;
+	uint32_t nextLine;
+	uint32_t endLine;
+	bool decode;
+};
+
+void ESPBASE::handleApiLog(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	uint32_t since = request->hasArg("since") ? strtoul(request->arg("since").c_str(), nullptr, 10) : 0;
+	bool decode = request->hasArg("decode") && request->arg("decode") == "1";
+	AsyncWebServerResponse* response = ChunkedResponse::begin(request, "text/plain", new LogResponse(since, decode));
+	response->addHeader("Cache-Control", "no-store");
+	request->send(response);
 }
 
+// /api/capture: the flash capture ring, oldest first, then what still waits in RAM;
+// text as in captures.txt, or binary as taken by /api/inject (frames and pauses only)
+class CaptureExportResponse : public ChunkedResponse
+{
+public:
+	CaptureExportResponse(bool binary) : binary(binary), segment(capture.getFirstSegment())
+	{
+		capture.beginExport();
+		if (!capture.hasSegments())
+			segment = capture.getLastSegment() + 1;
+	}
+	~CaptureExportResponse()
+	{
+		capture.endExport();
+	}
+
+protected:
+	bool next() override
+	{
+		uint8_t record[CAPTURE_RECORD_MAX];
+		size_t size;
+		while (0 == (size = readRecord(record)))
+		{
+			if (done)
+				return false;
+		}
+		printRecord(record, size);
+		return true;
+	}
 
-void ESPBASE::handleConsole()
+private:
+	// the next record, 0 when the current source ran out
+	size_t readRecord(uint8_t* record)
+	{
+		if (segment <= capture.getLastSegment())
+		{
+			if (!file)
+				file = CaptureRing::openSegment(segment);
+			size_t size = file ? CaptureRing::readRecord(file, record) : 0;
+			if (0 == size)
+			{
+				// a damaged record ends its segment
+				file.close();
+				++segment;
+			}
+			return size;
+		}
+		size_t batchLen;
+		const uint8_t* batch = capture.getBatch(batchLen);
+		size_t size = batchOffset < batchLen ? CaptureRing::recordSize(batch + batchOffset, batchLen - batchOffset) : 0;
+		if (0 == size)
+		{
+			done = true;
+			return 0;
+		}
+		memcpy(record, batch + batchOffset, size);
+		batchOffset += size;
+		return size;
+	}
+
+	void printRecord(const uint8_t* record, size_t size)
+	{
+		uint32_t time;
+		memcpy(&time, record + 1, 4);
+		switch (record[0])
+		{
+		case 'B':
+			hasFrameTime = false;
+			if (!binary)
+				print("# boot\n");
+			break;
+		case 'E':
+			if (!binary)
+			{
+				print("# ");
+				write(record + 6, size - 6);
+				print('\n');
+			}
+			break;
+		default:
+			if (hasFrameTime && time != frameTime)
+				printWait(time - frameTime);
+			hasFrameTime = true;
+			frameTime = time;
+			if (binary)
+			{
+				write(record, 1);
+				write(record + 5, 16);
+			}
+			else
+			{
+				Log::Line line = {};
+				line.kind = 'T' == record[0] ? Log::KIND_TX : Log::KIND_RX;
+				line.frame = record + 5;
+				char text[LOG_FRAME_TEXT_SIZE];
+				print(Log::formatFrame(line, text));
+				print('\n');
+			}
+			break;
+		}
+	}
+
+	void printWait(uint32_t ms)
+	{
+		if (!binary)
+		{
+			printf("WAIT: %u\n", (unsigned)ms);
+			return;
+		}
+		while (ms > 0)
+		{
+			uint16_t part = std::min<uint32_t>(ms, 0xFFFF);
+			uint8_t item[3] = {'W', (uint8_t)part, (uint8_t)(part >> 8)};
+			write(item, sizeof(item));
+			ms -= part;
+		}
+	}
+
+	bool binary;
+	uint32_t segment;
+	File file;
+	size_t batchOffset = 0;
+	bool done = false;
+	bool hasFrameTime = false;
+	uint32_t frameTime = 0;
+};
+
+void ESPBASE::handleApiCapture(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	if (!capture.isMounted())
+	{
+		request->send(404, "application/json", "{\"error\":\"capture is off\"}");
+		return;
+	}
+	bool binary = request->hasArg("format") && request->arg("format") == "bin";
+	AsyncWebServerResponse* response = ChunkedResponse::begin(request, binary ? "application/octet-stream" : "text/plain",
+	                                                          new CaptureExportResponse(binary));
+	response->addHeader("Content-Disposition", binary ? "attachment; filename=capture.bin" : "attachment; filename=captures.txt");
+	response->addHeader("Cache-Control", "no-store");
+	request->send(response);
+}
+
+void ESPBASE::handleApiState(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+
+	// a poller that is up to date gets an empty 304
+	char etag[24];
+	snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned)bootId, (unsigned)state->getVersion());
+	AsyncWebServerResponse* response;
+	if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag)
+		response = request->beginResponse(304);
+	else
+		response = ChunkedResponse::begin(request, "application/json", new StateJsonResponse(*state));
+	response->addHeader("ETag", etag);
+	response->addHeader("Cache-Control", "no-cache");
+	request->send(response);
+}
+
+void ESPBASE::handleApiWrite(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+
+	int day = 0;
+	if (request->url().startsWith("/api/schedule"))
+	{
+		day = request->url().length() == 15 ? request->url()[14] - '0' : 0;
+		if (!request->url().startsWith("/api/schedule/") || day < 1 || day > 7)
+		{
+			request->send(404, "application/json", "{\"error\":\"day must be 1..7\"}");
+			return;
+		}
+	}
+	if (!request->_tempObject)
+	{
+		request->send(400, "application/json", "{\"error\":\"missing or too large body\"}");
+		return;
+	}
+	if (apiWrite.active)
+	{
+		request->send(503, "application/json", "{\"error\":\"busy\"}");
+		return;
+	}
+
+	// the UART belongs to the loop, hand the write over to handle()
+	apiWrite.request = request;
+	apiWrite.json = (const char*)request->_tempObject;
+	apiWrite.day = day;
+	apiWrite.waiting = 0;
+	apiWrite.sent = false;
+	apiWrite.active = true;
+	request->onDisconnect([this, request]() {
+		if (apiWrite.request == request)
+			apiWrite.request = nullptr;
+	});
+}
+
+void ESPBASE::handleApiWritePending()
+{
+	if (!apiWrite.sent)
+	{
+		apiWrite.sent = true;
+		bool ok = apiWrite.day ? state->setSchedule(apiWrite.day, apiWrite.json, &apiWrite.waiting)
+		                       : state->setSettings(apiWrite.json, &apiWrite.waiting);
+		apiWrite.json = String();
+		if (!ok)
+		{
+			finishApiWrite(400, "{\"error\":\"invalid values, see the log\"}");
+			return;
+		}
+		if (0 == apiWrite.waiting)
+		{
+			// nothing to confirm, an empty object must not read as a confirmed write
+			finishApiWrite(400, "{\"error\":\"no writable fields\"}");
+			return;
+		}
+		// ask right away instead of waiting for the MCU to report on its own
+		for (uint8_t type = C17GH3MessageBase::MSG_TYPE_SETTINGS1; type <= C17GH3MessageBase::MSG_TYPE_SCHEDULE_DAY7; ++type)
+		{
+			if (apiWrite.waiting & C17GH3State::writeMask(type))
+			{
+				C17GH3MessageQuery query((C17GH3MessageBase::C17GH3MessageType)type);
+				query.pack();
+				state->sendMessage(query);
+			}
+		}
+		apiWrite.deadline = millis() + HTTP_API_CONFIRM_MS;
+	}
+
+	apiWrite.waiting &= state->getUnconfirmedWrites();
+	if (0 == apiWrite.waiting)
+		finishApiWrite(200, "{\"confirmed\":true}");
+	else if ((int32_t)(millis() - apiWrite.deadline) >= 0)
+		finishApiWrite(504, "{\"confirmed\":false}");
+}
+
+void ESPBASE::finishApiWrite(int code, const char* json)
 {
-	if(config.OTApwd.length() > 0)
+	if (apiWrite.request)
+		apiWrite.request->send(code, "application/json", json);
+	apiWrite.request = nullptr;
+	apiWrite.active = false;
+}
+
+// binary for application/octet-stream, text for text/plain; other types get no body callback or are refused
+static bool injectBinary(AsyncWebServerRequest* request, bool& binary)
+{
+	binary = request->contentType().startsWith("application/octet-stream");
+	return binary || request->contentType().startsWith("text/plain");
+}
+
+// the frames are parsed as the body arrives, nothing of it is kept
+void ESPBASE::handleInjectBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total)
+{
+	if (0 == index)
 	{
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
+		// runs before the request handler, which does the authentication
+		if (config.OTApwd[0] && !request->authenticate("admin", config.OTApwd))
+			return;
+		bool binary;
+		if (!injectBinary(request, binary))
+			return;
+		uint16_t interval = request->hasArg("interval") ? request->arg("interval").toInt() : HTTP_INJECT_INTERVAL_MS;
+		if (!injector.begin(binary, interval))
+			return;
+		injectRequest = request;
+		request->onDisconnect([this, request]() {
+			if (injectRequest == request)
+			{
+				injectRequest = nullptr;
+				injectAckPending = false;
+				injector.end();
+			}
+		});
 	}
+	if (injectRequest != request)
+		return;
+	injector.feed(data, len);
+	// the TCP window closes until the queue ran empty, the sender cannot get ahead of the injection
+	if (injector.getQueued() > 0 && index + len < total)
+	{
+		request->client()->ackLater();
+		injectAckPending = true;
+	}
+}
+
+// POST /api/inject[?interval=ms], answered from handle() once every frame is injected.
+// The body needs Content-Type text/plain or application/octet-stream: a form
+// type such as curl's default for --data-binary is parsed into parameters and
+// never reaches the injector.
+void ESPBASE::handleInject(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	if (injectRequest != request)
+	{
+		bool binary;
+		if (!injectBinary(request, binary))
+			request->send(415, "application/json", "{\"error\":\"use Content-Type text/plain or application/octet-stream\"}");
+		else if (injector.isActive())
+			request->send(503, "application/json", "{\"error\":\"busy\"}");
+		else
+			request->send(400, "application/json", "{\"error\":\"no frames\"}");
+		return;
+	}
+	injector.end();
+}
+
+void ESPBASE::handleStatus(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	ChunkedResponse::send(request, "text/html", new StatusResponse(*state));
+}
+
+
+void ESPBASE::handleConsole(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
 	
-	if (server.hasArg("cmd"))
+	if (request->hasArg("cmd"))
     {
-		String cmd = server.arg("cmd");
+		String cmd = request->arg("cmd");
 		cmd.trim();
 		cmd.replace(" ","");
-		logger.addLine("Got a post cmd: " + cmd);
-		
-		if (cmd.length() == 35)
+		LOG_INFO(HTTP, "Got a post cmd: %s", cmd.c_str());
+
+		// RX/TX frames touch the state and the UART, they are run from loop()
+		if (consoleCommandCount == HTTP_COMMAND_QUEUE_SIZE)
 		{
-			if (cmd.startsWith("RX:"))
-			{
-				cmd = cmd.substring(3);
-				while (cmd.length() > 0)
-				{
-					String v = cmd.substring(0,2);
-					cmd = cmd.substring(2);
-					state->processRx(strtol(v.c_str(), nullptr, 16));
-				}
-			}
-			else if (cmd.startsWith("TX:"))
-			{
-				cmd = cmd.substring(3);
-				C17GH3MessageBuffer buffer;
-				
-				while (cmd.length() > 0)
-				{
-					String v = cmd.substring(0,2);
-					cmd = cmd.substring(2);
-					bool hasMsg = buffer.addbyte(strtol(v.c_str(), nullptr, 16));
-					if (hasMsg)
-					{
-						C17GH3MessageBase msg(buffer.getBytes());
-						msg.pack();
-						state->sendMessage(msg);
-					}
-				}
+			request->send(503, "text/plain", "Busy");
+			return;
+		}
+		consoleCommands[(consoleCommandFirst + consoleCommandCount) % HTTP_COMMAND_QUEUE_SIZE] = cmd;
+		++consoleCommandCount;
 
-			}
+		// the console page posts in the background and shows the result through its log tail
+		if (request->hasHeader("X-Requested-With"))
+		{
+			request->send(200, "text/plain", "OK");
+			return;
 		}
     }
-	String msg( R"=====(
-  <meta name="viewport" content="width=device-width, initial-scale=1" />
-  <meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
-  <a href="/"  class="btn btn--s"><</a>&nbsp;&nbsp;<strong>Console</strong>
-  <hr>
-  )=====");
-	msg += "<script>";
-	msg += "function sb(){ var c = document.getElementById('console');c.scrollTop = c.scrollHeight;}";
-	msg += "</script></head>";
-	msg += "<body onload='sb();'>";
-	msg += "<form method='POST'>";
-	msg += "<textarea id='console' style='width:100%;height:calc(100% - 50px);'>";
-	msg += logger.getLines();
-	msg += "</textarea>";
-	msg += "<br/>";
-	msg += "<input type='text' name='cmd' style='width:calc(100% - 100px);'></input><input type=submit value='send' style='width:100px;'></input>";
-	msg += "</form>";
-	msg += String(R"=====(
-  <script>
-  window.onload = function ()
-  {
-	  load("style.css","css", function() 
-	  {
-		  load("microajax.js","js", function() 
-		  {
-				setValues("/admin/generalvalues");
-		  });
-	  });
-  }
-  function load(e,t,n){if("js"==t){var a=document.createElement("script");a.src=e,a.type="text/javascript",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}else if("css"==t){var a=document.createElement("link");a.href=e,a.rel="stylesheet",a.type="text/css",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}}
-  </script>
-)=====" );
-	server.send(200, "text/html", msg);
+	SEND_GZIP_ASSET ( request, PAGE_Console, "text/html", CACHE_PAGE );
 }
 
+void ESPBASE::applyConsoleCommand(String cmd)
+{
+	if (cmd.startsWith("log:"))
+	{
+		applyLogLevelCommand(cmd.c_str() + 4);
+		return;
+	}
+
+	uint8_t bytes[16];
+	if (cmd.length() != 35 || 16 != FrameInjector::parseHex(cmd.c_str() + 3, 32, bytes, sizeof(bytes)))
+		return;
+	if (cmd.startsWith("RX:"))
+	{
+		for (uint8_t b : bytes)
+			state->processRx((int)b);
+	}
+	else if (cmd.startsWith("TX:"))
+	{
+		C17GH3MessageBuffer buffer;
+		for (uint8_t b : bytes)
+		{
+			if (buffer.addbyte(b))
+			{
+				C17GH3MessageBase msg(buffer.getBytes());
+				msg.pack();
+				state->sendMessage(msg);
+			}
+		}
+	}
+}
+
+// "<category>=<level>", "*" for every category
+void ESPBASE::applyLogLevelCommand(const char* cmd)
+{
+	char name[8];
+	const char* eq = strchr(cmd, '=');
+	if (!eq || (size_t)(eq - cmd) >= sizeof(name))
+		return;
+	memcpy(name, cmd, eq - cmd);
+	name[eq - cmd] = 0;
+	uint8_t level = Log::findLevel(eq + 1);
+	if (level > LOG_LEVEL_TRACE)
+		return;
+	for (uint8_t c = 0; c < Log::CAT_COUNT; ++c)
+	{
+		if (0 == strcmp(name, "*") || Log::findCategory(name) == c)
+		{
+			logger.setLevel((Log::Category)c, level);
+			// LOG_LEVEL_NONE passes every limit, the confirmation shows even for a category switched off
+			logger.addLinef(LOG_LEVEL_NONE, (Log::Category)c, "Log level %s: %s", Log::getCategoryName((Log::Category)c),
+			                Log::getLevelName(logger.getLevel((Log::Category)c)));
+		}
+	}
+}
 
 void ESPBASE::OTASetup()
 {
@@ -320,9 +973,9 @@ void ESPBASE::OTASetup()
         });
 
        /* setup the OTA server */
-      if(config.OTApwd.length() > 0)
+      if(config.OTApwd[0])
       {
-        ArduinoOTA.setPassword(config.OTApwd.c_str());   
+        ArduinoOTA.setPassword(config.OTApwd);   
       }
       ArduinoOTA.begin();
 }
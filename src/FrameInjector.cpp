@@ -0,0 +1,267 @@
+#include "FrameInjector.h"
+#include "C17GH3.h"
+
+#define FRAME_INJECTOR_MAX_WAIT 60000
+
+static int hexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+int FrameInjector::parseHex(const char* text, size_t len, uint8_t* out, size_t maxLen)
+{
+	size_t nibbles = 0;
+	for (size_t i = 0; i < len; ++i)
+	{
+		if (' ' == text[i] || '\t' == text[i])
+			continue;
+		int v = hexValue(text[i]);
+		if (v < 0 || nibbles / 2 >= maxLen)
+			return -1;
+		if (nibbles % 2)
+			out[nibbles / 2] |= v;
+		else
+			out[nibbles / 2] = v << 4;
+		++nibbles;
+	}
+	return nibbles % 2 ? -1 : nibbles / 2;
+}
+
+bool FrameInjector::begin(bool isBinary, uint16_t interval)
+{
+	if (active)
+		return false;
+	active = true;
+	ended = false;
+	binary = isBinary;
+	intervalMs = interval;
+	nextInjectAt = millis();
+	head = 0;
+	count = 0;
+	parseState = binary ? PARSE_TAG : PARSE_KEYWORD;
+	keywordLen = 0;
+	pendingDelay = 0;
+	processed = 0;
+	rejected = 0;
+	coalesced = 0;
+	return true;
+}
+
+void FrameInjector::feed(const uint8_t* data, size_t len)
+{
+	if (!active || ended)
+		return;
+	for (size_t i = 0; i < len; ++i)
+	{
+		if (binary)
+			parseBinary(data[i]);
+		else
+			parseText((char)data[i]);
+	}
+}
+
+void FrameInjector::end()
+{
+	if (!active || ended)
+		return;
+	if (!binary)
+		endLine();
+	else if (PARSE_PAYLOAD == parseState)
+		++rejected;		// cut off
+	ended = true;
+}
+
+void FrameInjector::finish()
+{
+	active = false;
+}
+
+void FrameInjector::parseText(char c)
+{
+	if ('\n' == c || '\r' == c)
+	{
+		endLine();
+		return;
+	}
+
+	switch (parseState)
+	{
+	case PARSE_KEYWORD:
+		if (':' == c)
+		{
+			keyword[keywordLen] = 0;
+			frameLen = 0;
+			waitMs = 0;
+			lineBad = false;
+			if (0 == strcmp(keyword, "RX") || 0 == strcmp(keyword, "TX"))
+			{
+				frameTx = ('T' == keyword[0]);
+				parseState = PARSE_FRAME;
+			}
+			else if (0 == strcmp(keyword, "WAIT"))
+			{
+				parseState = PARSE_WAIT;
+			}
+			else
+			{
+				parseState = PARSE_SKIP;
+			}
+		}
+		else if (' ' == c || '\t' == c)
+		{
+			if (keywordLen > 0)
+				parseState = PARSE_SKIP;
+		}
+		else if (keywordLen < sizeof(keyword) - 1 && isalpha(c))
+		{
+			keyword[keywordLen++] = c;
+		}
+		else
+		{
+			parseState = PARSE_SKIP;
+		}
+		break;
+	case PARSE_FRAME:
+		if (' ' == c || '\t' == c)
+			break;
+		if (hexValue(c) < 0 || frameLen >= 2 * sizeof(frame))
+		{
+			lineBad = true;
+			break;
+		}
+		if (frameLen % 2)
+			frame[frameLen / 2] |= hexValue(c);
+		else
+			frame[frameLen / 2] = hexValue(c) << 4;
+		++frameLen;
+		break;
+	case PARSE_WAIT:
+		if (' ' == c || '\t' == c)
+			break;
+		if (c < '0' || c > '9')
+			lineBad = true;
+		else
+			waitMs = std::min<uint32_t>(waitMs * 10 + (c - '0'), FRAME_INJECTOR_MAX_WAIT);
+		break;
+	default:
+		break;
+	}
+}
+
+void FrameInjector::endLine()
+{
+	if (PARSE_FRAME == parseState)
+	{
+		if (!lineBad && 2 * sizeof(frame) == frameLen)
+			push(frameTx);
+		else
+			++rejected;
+	}
+	else if (PARSE_WAIT == parseState)
+	{
+		if (!lineBad)
+			pendingDelay = std::min<uint32_t>(pendingDelay + waitMs, FRAME_INJECTOR_MAX_WAIT);
+		else
+			++rejected;
+	}
+	parseState = PARSE_KEYWORD;
+	keywordLen = 0;
+}
+
+void FrameInjector::parseBinary(uint8_t b)
+{
+	switch (parseState)
+	{
+	case PARSE_TAG:
+		if ('R' == b || 'T' == b || 'W' == b)
+		{
+			tag = b;
+			frameLen = 0;
+			parseState = PARSE_PAYLOAD;
+		}
+		else
+		{
+			// no way to find the next item
+			++rejected;
+			parseState = PARSE_STOPPED;
+		}
+		break;
+	case PARSE_PAYLOAD:
+		frame[frameLen++] = b;
+		if ('W' == tag && 2 == frameLen)
+		{
+			pendingDelay = std::min<uint32_t>(pendingDelay + (frame[0] | (frame[1] << 8)), FRAME_INJECTOR_MAX_WAIT);
+			parseState = PARSE_TAG;
+		}
+		else if (sizeof(frame) == frameLen)
+		{
+			push('T' == tag);
+			parseState = PARSE_TAG;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void FrameInjector::push(bool tx)
+{
+	if (count > 0 && 0 == pendingDelay)
+	{
+		const Frame& last = queue[(head + count - 1) % FRAME_INJECTOR_QUEUE_SIZE];
+		if (last.tx == tx && 0 == memcmp(last.bytes, frame, sizeof(frame)))
+		{
+			++coalesced;
+			return;
+		}
+	}
+	if (FRAME_INJECTOR_QUEUE_SIZE == count)
+	{
+		++rejected;
+		return;
+	}
+	Frame& f = queue[(head + count) % FRAME_INJECTOR_QUEUE_SIZE];
+	memcpy(f.bytes, frame, sizeof(frame));
+	f.tx = tx;
+	f.delayMs = pendingDelay;
+	pendingDelay = 0;
+	++count;
+}
+
+void FrameInjector::update(C17GH3State& state)
+{
+	uint32_t now = millis();
+	if (0 == count || (int32_t)(now - nextInjectAt) < 0)
+		return;
+
+	Frame& f = queue[head];
+	if (f.delayMs > 0)
+	{
+		nextInjectAt = now + f.delayMs;
+		f.delayMs = 0;
+		return;
+	}
+
+	if (f.tx)
+	{
+		C17GH3MessageBase msg(f.bytes);
+		msg.pack();
+		state.sendMessage(msg);
+	}
+	else
+	{
+		// byte by byte, so the framing of the decoder is exercised as well
+		for (uint8_t b : f.bytes)
+			state.processRx((int)b);
+	}
+	nextInjectAt = now + std::max<uint32_t>(intervalMs, f.tx ? FRAME_INJECTOR_UART_MS : 0);
+	head = (head + 1) % FRAME_INJECTOR_QUEUE_SIZE;
+	--count;
+	++processed;
+}
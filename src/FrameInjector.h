@@ -0,0 +1,97 @@
+#ifndef FRAMEINJECTOR_H
+#define FRAMEINJECTOR_H
+#include <Arduino.h>
+
+class C17GH3State;
+
+// Batches of RX/TX frames for load testing without an MCU, fed in pieces as
+// the request body arrives and injected from loop() at a controlled rate.
+//
+// Text, as in captures.txt, one item per line, all other lines are ignored:
+//   RX: aa 55 c1 05 ff ff ff ff 1e ff ff ff 00 00 ff db   decoded as if the MCU had sent it
+//   TX: aa 55 c1 05 00 be 00 9d 1e 00 00 00 00 00 ff 3d   checksum fixed and sent over the UART
+//   WAIT: 250                                            pause in ms before the next frame
+// Binary, a tag byte per item: 'R' or 'T' + 16 frame bytes, 'W' + uint16 ms little endian.
+//
+// A frame identical to the one still waiting before it is coalesced into it.
+// 20 bytes per queued frame: 128 frames = 2.5 KB, enough for the 2144 byte TCP
+// window of the default lwIP build even in binary (126 frames), so a sender that
+// is only acknowledged once the queue ran empty never overflows it.
+#define FRAME_INJECTOR_QUEUE_SIZE 128
+#define FRAME_INJECTOR_UART_MS 17          // 16 bytes at 9600 baud, TX frames never go out faster
+
+class FrameInjector
+{
+public:
+	// starts a batch, false while the previous one is still running
+	bool begin(bool binary, uint16_t intervalMs);
+	// the next piece of the batch, parsed in place
+	void feed(const uint8_t* data, size_t len);
+	// the batch is complete, the frames still queued are injected by update()
+	void end();
+	// injects the next frame when it is due, call from loop()
+	void update(C17GH3State& state);
+	// the result was reported, a new batch may begin
+	void finish();
+
+	bool isActive() const { return active; }
+	bool isDone() const { return ended && 0 == count; }
+	uint8_t getQueued() const { return count; }
+
+	uint16_t getProcessed() const { return processed; }
+	uint16_t getRejected() const { return rejected; }
+	uint16_t getCoalesced() const { return coalesced; }
+
+	// hex digits into out, whitespace skipped; the number of bytes, -1 on anything else or more than maxLen bytes
+	static int parseHex(const char* text, size_t len, uint8_t* out, size_t maxLen);
+
+private:
+	struct Frame
+	{
+		uint8_t bytes[16];
+		uint16_t delayMs;	// before this frame
+		bool tx;
+	};
+
+	enum ParseState : uint8_t
+	{
+		PARSE_KEYWORD,	// text: start of line up to ':'
+		PARSE_FRAME,	// text: hex bytes of an RX/TX line
+		PARSE_WAIT,		// text: decimal ms
+		PARSE_SKIP,		// text: rest of a line that is not an item
+		PARSE_TAG,		// binary: tag byte
+		PARSE_PAYLOAD,	// binary: frame or delay bytes
+		PARSE_STOPPED	// binary: unknown tag, the rest cannot be framed
+	};
+
+	void parseText(char c);
+	void parseBinary(uint8_t b);
+	void endLine();
+	void push(bool tx);
+
+	Frame queue[FRAME_INJECTOR_QUEUE_SIZE];
+	uint8_t head = 0;
+	uint8_t count = 0;
+
+	ParseState parseState = PARSE_KEYWORD;
+	char keyword[5];
+	uint8_t keywordLen = 0;
+	uint8_t frame[16];
+	uint8_t frameLen = 0;		// nibbles for text, bytes for binary
+	uint8_t tag = 0;
+	bool frameTx = false;
+	bool lineBad = false;
+	uint32_t waitMs = 0;
+	uint32_t pendingDelay = 0;	// WAIT items before the next frame
+
+	bool active = false;
+	bool ended = false;
+	bool binary = false;
+	uint16_t intervalMs = 0;
+	uint32_t nextInjectAt = 0;
+
+	uint16_t processed = 0;
+	uint16_t rejected = 0;
+	uint16_t coalesced = 0;
+};
+#endif
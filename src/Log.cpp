@@ -1,41 +1,204 @@
 #include "Log.h"
+#include <stdarg.h>
 
-void Log::addLine(const String& line)
+// the header fields go through memcpy, the records are not aligned
+
+size_t Log::recordSize(size_t offset) const
+{
+	uint16_t len;
+	memcpy(&len, buffer + offset + 8, sizeof(len));
+	return HEADER_SIZE + len + (KIND_TEXT == buffer[offset + 10] ? 1 : 0);
+}
+
+size_t Log::nextRecord(size_t offset) const
+{
+	offset += recordSize(offset);
+	return offset == wrap ? 0 : offset;
+}
+
+void Log::readLine(size_t offset, Line& line) const
+{
+	memcpy(&line.id, buffer + offset, 4);
+	memcpy(&line.time, buffer + offset + 4, 4);
+	memcpy(&line.length, buffer + offset + 8, 2);
+	line.kind = (Kind)buffer[offset + 10];
+	line.level = buffer[offset + 11] >> 4;
+	line.category = (Category)(buffer[offset + 11] & 0x0F);
+	line.text = KIND_TEXT == line.kind ? (const char*)buffer + offset + HEADER_SIZE : nullptr;
+	line.frame = KIND_TEXT == line.kind ? nullptr : buffer + offset + HEADER_SIZE;
+}
+
+void Log::dropOldest()
+{
+	if (0 == --count)
+	{
+		head = tail = 0;
+		wrap = LOG_BUFFER_SIZE;
+		return;
+	}
+	head = nextRecord(head);
+	if (0 == head)
+		wrap = LOG_BUFFER_SIZE;
+}
+
+// drops the oldest records until [offset, offset + len) holds none
+void Log::makeRoom(size_t offset, size_t len)
+{
+	while (count > 0 && head >= offset && head < offset + len)
+		dropOldest();
+}
+
+static const char* const categoryNames[Log::CAT_COUNT] = {"sys", "uart", "mqtt", "http", "ntp", "wifi"};
+static const char* const levelNames[LOG_LEVEL_TRACE + 1] = {"none", "error", "warn", "info", "debug", "trace"};
+
+const char* Log::getCategoryName(Category category)
+{
+	return category < CAT_COUNT ? categoryNames[category] : "";
+}
+
+const char* Log::getLevelName(uint8_t level)
+{
+	return level <= LOG_LEVEL_TRACE ? levelNames[level] : "";
+}
+
+Log::Category Log::findCategory(const char* name)
+{
+	for (uint8_t c = 0; c < CAT_COUNT; ++c)
+	{
+		if (0 == strcmp(name, categoryNames[c]))
+			return (Category)c;
+	}
+	return CAT_COUNT;
+}
+
+uint8_t Log::findLevel(const char* name)
 {
-	logSize += line.length();
-	logLines.push_back(std::make_pair(current_id++,line));
-	while (logSize > maxSize)
+	for (uint8_t l = 0; l <= LOG_LEVEL_TRACE; ++l)
 	{
-		logSize -= logLines.front().second.length();
-		logLines.pop_front();
+		if (0 == strcmp(name, levelNames[l]))
+			return l;
 	}
+	return LOG_LEVEL_TRACE + 1;
 }
 
-void Log::addBytes(const String& header, const uint8_t* bytes, uint8_t len)
+void Log::addLine(uint8_t level, Category category, const char* line)
 {
-	String s;
-	s += header;
-	for (int i = 0 ; i < len; ++i)
+	addLine(level, category, line, strlen(line));
+}
+
+void Log::addLine(uint8_t level, Category category, const char* line, size_t len)
+{
+	add(level, category, KIND_TEXT, (const uint8_t*)line, std::min<size_t>(len, LOG_LINE_MAX));
+}
+
+void Log::addLinef(uint8_t level, Category category, const char* format, ...)
+{
+	char line[LOG_LINE_MAX + 1];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (len < 0)
+		return;
+	add(level, category, KIND_TEXT, (const uint8_t*)line, std::min<size_t>(len, LOG_LINE_MAX));
+}
+
+void Log::addFrame(bool tx, const uint8_t* frame)
+{
+	add(LOG_LEVEL_TRACE, CAT_UART, tx ? KIND_TX : KIND_RX, frame, LOG_FRAME_SIZE);
+}
+
+void Log::add(uint8_t level, Category category, Kind kind, const uint8_t* data, size_t len)
+{
+	size_t need = HEADER_SIZE + len + (KIND_TEXT == kind ? 1 : 0);
+	size_t offset = tail;
+	if (offset + need > LOG_BUFFER_SIZE)
+	{
+		// no room before the end, the records continue at 0
+		makeRoom(offset, LOG_BUFFER_SIZE - offset);
+		if (count > 0)
+			wrap = offset;
+		offset = 0;
+	}
+	makeRoom(offset, need);
+
+	uint32_t id = current_id++;
+	uint32_t time = millis();
+	uint16_t length = len;
+	memcpy(buffer + offset, &id, 4);
+	memcpy(buffer + offset + 4, &time, 4);
+	memcpy(buffer + offset + 8, &length, 2);
+	buffer[offset + 10] = kind;
+	buffer[offset + 11] = (level << 4) | category;
+	memcpy(buffer + offset + HEADER_SIZE, data, len);
+	if (KIND_TEXT == kind)
+		buffer[offset + HEADER_SIZE + len] = 0;
+	tail = offset + need;
+	++count;
+
+	if (lineCallback)
 	{
-		s += " ";
-		if (bytes[i] < 10)
-			s += "0";
-		s += String(bytes[i], HEX);
+		Line added;
+		readLine(offset, added);
+		lineCallback(added);
 	}
-	addLine(s);
 }
 
+bool Log::getLine(uint32_t& next_idx, uint32_t end_idx, Line& line) const
+{
+	size_t offset = head;
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		if (i > 0)
+			offset = nextRecord(offset);
+		uint32_t id;
+		memcpy(&id, buffer + offset, 4);
+		if (id >= end_idx)
+			break;
+		if (id >= next_idx)
+		{
+			readLine(offset, line);
+			next_idx = id + 1;
+			return true;
+		}
+	}
+	return false;
+}
 
-String Log::getLines(uint32_t from_idx) const
+const char* Log::formatFrame(const Line& line, char* out)
 {
-	String lines;
-	for (const auto &line : logLines )
+	static const char digits[] = "0123456789abcdef";
+	memcpy(out, KIND_TX == line.kind ? "TX:" : "RX:", 3);
+	char* p = out + 3;
+	for (int i = 0; i < LOG_FRAME_SIZE; ++i)
 	{
-		if (line.first >= from_idx)
+		*p++ = ' ';
+		*p++ = digits[line.frame[i] >> 4];
+		*p++ = digits[line.frame[i] & 0x0F];
+	}
+	*p = 0;
+	return out;
+}
+
+bool Log::printLine(Print& out, uint32_t& next_idx, uint32_t end_idx, bool decode) const
+{
+	Line line;
+	if (!getLine(next_idx, end_idx, line))
+		return false;
+	if (KIND_TEXT == line.kind)
+	{
+		out.write((const uint8_t*)line.text, line.length);
+	}
+	else
+	{
+		char text[LOG_FRAME_TEXT_SIZE];
+		out.print(formatFrame(line, text));
+		if (decode && frameDecoder)
 		{
-			lines += line.second;
-			lines += "\n";
+			out.print(" | ");
+			frameDecoder(out, line.frame, KIND_TX == line.kind);
 		}
 	}
-	return lines;
-}
\ No newline at end of file
+	out.print('\n');
+	return true;
+}
@@ -1,20 +1,181 @@
 #ifndef LOG_H
 #define LOG_H
 #include <Arduino.h>
-#include <list>
+#include <functional>
+
+// Lines kept in one static byte ring, so logging never allocates and the
+// heap does not fragment over weeks of uptime. Each record is a 12 byte
+// header (id, millis, length, kind, level and category) and either the NUL
+// terminated text or a raw UART frame, which is only turned into hex when the
+// log is read; the oldest records are dropped to make room. 3200 bytes hold
+// about 114 frames.
+#define LOG_BUFFER_SIZE 3200
+#define LOG_LINE_MAX 200                  // longer lines are cut
+#define LOG_FRAME_SIZE 16
+#define LOG_FRAME_TEXT_SIZE 52            // "RX:" and 16 " xx", NUL terminated
+
+// Severities, a line is kept when its level is at or below the limit of its
+// category. LOG_LEVEL is the compile time limit, statements above it are not
+// compiled at all (-DLOG_LEVEL=LOG_LEVEL_INFO drops the protocol tracing); the
+// runtime limits start at LOG_LEVEL and are changed with the console command
+// "log:<category>=<level>". A filtered statement costs one branch and its
+// arguments are not formatted. LOG_INFO(MQTT, "connected in %u ms", ms)
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5                 // every UART frame
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_TRACE
+#endif
 
 class Log
 {
 public:
-	Log(uint32_t maxSize = 80 * 40) : maxSize(maxSize) {} // save about 20 lines
-	void addLine(const String& line);
-	void addBytes(const String& header, const uint8_t* bytes, uint8_t len);
-	String getLines(uint32_t from_idx = 0) const;
+	enum Category : uint8_t
+	{
+		CAT_SYS,
+		CAT_UART,
+		CAT_MQTT,
+		CAT_HTTP,
+		CAT_NTP,
+		CAT_WIFI,
+		CAT_COUNT
+	};
+
+	enum Kind : uint8_t
+	{
+		KIND_TEXT,
+		KIND_RX,			// frame from the MCU
+		KIND_TX				// frame to the MCU
+	};
+
+	// a line in the ring, valid until the next line is added
+	struct Line
+	{
+		uint32_t id;
+		uint32_t time;		// millis() when added
+		Kind kind;
+		uint8_t level;
+		Category category;
+		const char* text;	// NUL terminated, KIND_TEXT only
+		const uint8_t* frame;	// LOG_FRAME_SIZE bytes, KIND_RX/KIND_TX only
+		uint16_t length;
+	};
+
+	// use the LOG_* macros below, they skip the call when the line would be filtered
+	void addLine(uint8_t level, Category category, const char* line);
+	void addLine(uint8_t level, Category category, const char* line, size_t len);
+	void addLinef(uint8_t level, Category category, const char* format, ...) __attribute__((format(printf, 4, 5)));
+	// a UART frame of LOG_FRAME_SIZE bytes, logged as CAT_UART trace
+	void addFrame(bool tx, const uint8_t* frame);
+
+	bool isEnabled(uint8_t level, Category category) const
+	{
+		return level <= levels[category];
+	}
+	void setLevel(Category category, uint8_t level)
+	{
+		levels[category] = std::min<uint8_t>(level, LOG_LEVEL);
+	}
+	uint8_t getLevel(Category category) const
+	{
+		return levels[category];
+	}
+	static const char* getCategoryName(Category category);
+	static const char* getLevelName(uint8_t level);
+	// CAT_COUNT / LOG_LEVEL_TRACE + 1 when the name is unknown
+	static Category findCategory(const char* name);
+	static uint8_t findLevel(const char* name);
+
+	// the first line with an id in [next_idx, end_idx), moves next_idx past it; false if there is none
+	bool getLine(uint32_t& next_idx, uint32_t end_idx, Line& line) const;
+	// prints the first line with an id in [next_idx, end_idx) and moves next_idx past it, false if there is none;
+	// decode adds the frame decoder's summary to frames
+	bool printLine(Print& out, uint32_t& next_idx, uint32_t end_idx, bool decode = false) const;
+	// "RX: aa 55 ..." of a frame line into out (LOG_FRAME_TEXT_SIZE bytes), returns out
+	static const char* formatFrame(const Line& line, char* out);
+	uint32_t getNextId() const
+	{
+		return current_id;
+	}
+
+	// called for every new line
+	typedef std::function<void(const Line& line)> LineCallback;
+	void setLineCallback(LineCallback cb)
+	{
+		lineCallback = cb;
+	}
+
+	// prints a one line summary of a frame, for printLine(..., decode)
+	typedef std::function<void(Print& out, const uint8_t* frame, bool tx)> FrameDecoder;
+	void setFrameDecoder(FrameDecoder decoder)
+	{
+		frameDecoder = decoder;
+	}
 
 private:
-	std::list<std::pair<uint32_t,String>> logLines;
+	static const size_t HEADER_SIZE = 12;
+
+	void add(uint8_t level, Category category, Kind kind, const uint8_t* data, size_t len);
+
+	size_t recordSize(size_t offset) const;
+	size_t nextRecord(size_t offset) const;
+	void readLine(size_t offset, Line& line) const;
+	void dropOldest();
+	void makeRoom(size_t offset, size_t len);
+
+	uint8_t buffer[LOG_BUFFER_SIZE];
+	size_t head = 0;					// oldest record
+	size_t tail = 0;					// where the next record goes
+	size_t wrap = LOG_BUFFER_SIZE;		// end of the records before they continue at 0
+	uint16_t count = 0;
 	uint32_t current_id = 0;
-	uint32_t logSize = 0;
-	uint32_t maxSize = 80 * 40;
+	uint8_t levels[CAT_COUNT] = {LOG_LEVEL, LOG_LEVEL, LOG_LEVEL, LOG_LEVEL, LOG_LEVEL, LOG_LEVEL};
+	LineCallback lineCallback;
+	FrameDecoder frameDecoder;
 };
+
+extern Log logger;
+
+#define LOG_AT(level, category, ...) \
+	do \
+	{ \
+		if (logger.isEnabled(level, Log::CAT_##category)) \
+			logger.addLinef(level, Log::CAT_##category, __VA_ARGS__); \
+	} while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+#else
+#define LOG_ERROR(category, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(category, ...) LOG_AT(LOG_LEVEL_WARN, category, __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...) LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(category, ...) LOG_AT(LOG_LEVEL_TRACE, category, __VA_ARGS__)
+#define LOG_FRAME(tx, frame) \
+	do \
+	{ \
+		if (logger.isEnabled(LOG_LEVEL_TRACE, Log::CAT_UART)) \
+			logger.addFrame(tx, frame); \
+	} while (0)
+#else
+#define LOG_TRACE(category, ...) do {} while (0)
+#define LOG_FRAME(tx, frame) do {} while (0)
+#endif
 #endif
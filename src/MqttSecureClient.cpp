@@ -0,0 +1,116 @@
+#if MQTT_BEARSSL
+#include "MqttSecureClient.h"
+#include "Log.h"
+
+void MqttSecureClient::setServer(const char* h, uint16_t p)
+{
+	host = h;
+	port = p;
+	mqtt.setServer(host, port);
+}
+
+void MqttSecureClient::setWill(const char* topic, uint8_t qos, bool retain, const char* payload)
+{
+	willTopic = topic;
+	willQos = qos;
+	willRetain = retain;
+	willPayload = payload;
+}
+
+void MqttSecureClient::setSecure(bool s, const uint8_t* fingerprint)
+{
+	secure = s;
+	if (fingerprint)
+		tls.setFingerprint(fingerprint);
+	else
+		tls.setInsecure();
+	tls.setSession(&session);
+}
+
+void MqttSecureClient::connect()
+{
+	if (secure)
+	{
+		String server = String(host) + ":" + port;
+		if (server != probedServer)
+		{
+			// a ClientHello only, no handshake
+			fragmentAccepted = BearSSL::WiFiClientSecure::probeMaxFragmentLength(host, port, MQTT_TLS_FRAGMENT);
+			probedServer = server;
+			LOG_INFO(MQTT, "MQTT TLS max fragment length %u %s", MQTT_TLS_FRAGMENT, fragmentAccepted ? "accepted" : "not supported");
+		}
+		tls.setBufferSizes(fragmentAccepted ? MQTT_TLS_FRAGMENT : MQTT_TLS_RX_BUFFER_FULL, MQTT_TLS_TX_BUFFER);
+		mqtt.setClient(tls);
+	}
+	else
+	{
+		mqtt.setClient(plain);
+	}
+	mqtt.setBufferSize(MQTT_PACKET_SIZE);
+	mqtt.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+		MqttMessageProperties properties = {0, false, false};
+		if (messageCallback)
+			messageCallback(topic, (char*)payload, properties, length, 0, length);
+	});
+
+	if (!mqtt.connect(clientId, username, password, willTopic, willQos, willRetain, willPayload, cleanSession))
+	{
+		if (secure && tls.getLastSSLError())
+		{
+			LOG_WARN(MQTT, "MQTT TLS error: %d", tls.getLastSSLError());
+			closed(MqttDisconnectReason::TLS_FAILED);
+		}
+		else
+		{
+			closed(mqtt.state() > 0 ? MqttDisconnectReason::MQTT_REFUSED : MqttDisconnectReason::TCP_DISCONNECTED);
+		}
+		return;
+	}
+	wasConnected = true;
+	if (connectCallback)
+		connectCallback(false);
+}
+
+void MqttSecureClient::disconnect(bool force)
+{
+	if (force)
+	{
+		plain.stop();
+		tls.stop();
+	}
+	else
+	{
+		mqtt.disconnect();
+	}
+	if (wasConnected)
+		closed(MqttDisconnectReason::TCP_DISCONNECTED);
+}
+
+void MqttSecureClient::closed(MqttDisconnectReason reason)
+{
+	wasConnected = false;
+	if (disconnectCallback)
+		disconnectCallback(reason);
+}
+
+uint16_t MqttSecureClient::publish(const char* topic, uint8_t qos, bool retain, const char* payload)
+{
+	return mqtt.publish(topic, payload, retain) ? 1 : 0;
+}
+
+uint16_t MqttSecureClient::subscribe(const char* topic, uint8_t qos)
+{
+	return mqtt.subscribe(topic, qos) ? 1 : 0;
+}
+
+uint16_t MqttSecureClient::unsubscribe(const char* topic)
+{
+	return mqtt.unsubscribe(topic) ? 1 : 0;
+}
+
+void MqttSecureClient::loop()
+{
+	if (wasConnected && !mqtt.loop())
+		closed(MqttDisconnectReason::TCP_DISCONNECTED);
+}
+#endif
@@ -0,0 +1,107 @@
+#ifndef MQTTSECURECLIENT_H
+#define MQTTSECURECLIENT_H
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecure.h>
+#include <PubSubClient.h>
+#include <functional>
+
+// The MQTT client of the esp12e_tls build: PubSubClient over BearSSL, behind
+// the part of the AsyncMqttClient interface main.cpp uses.
+//
+// The TLS session is kept across reconnects, so only the first connect does
+// the full handshake (1-2 s of loop() at 80 MHz with an RSA 2048 certificate)
+// and the next ones resume it. The record buffers follow the broker: when it
+// accepts the max fragment length extension they are MQTT_TLS_FRAGMENT bytes,
+// otherwise the receive buffer has to take a full 16 KB record. The broker is
+// probed for it once per server.
+//
+// Unlike AsyncMqttClient, connect() blocks until the broker answered, the
+// callbacks run from connect(), disconnect() and loop(), and messages are
+// published with QoS 0.
+#ifndef MQTT_TLS_FRAGMENT
+#define MQTT_TLS_FRAGMENT 1024            // 512, 1024, 2048 or 4096
+#endif
+#ifndef MQTT_TLS_TX_BUFFER
+#define MQTT_TLS_TX_BUFFER 1024
+#endif
+#define MQTT_TLS_RX_BUFFER_FULL 16384
+#define MQTT_PACKET_SIZE 1280             // the largest command payload and its topic
+
+struct MqttMessageProperties
+{
+	uint8_t qos;
+	bool dup;
+	bool retain;
+};
+
+enum class MqttDisconnectReason : int8_t
+{
+	TCP_DISCONNECTED = 0,
+	MQTT_REFUSED = 1,
+	TLS_FAILED = 2
+};
+
+class MqttSecureClient
+{
+public:
+	typedef std::function<void(bool sessionPresent)> ConnectCallback;
+	typedef std::function<void(MqttDisconnectReason reason)> DisconnectCallback;
+	typedef std::function<void(char* topic, char* payload, MqttMessageProperties properties, size_t len, size_t index, size_t total)> MessageCallback;
+
+	// the strings are not copied, they have to live as long as the client
+	void setServer(const char* host, uint16_t port);
+	void setClientId(const char* id) { clientId = id; }
+	void setCredentials(const char* user, const char* pass)
+	{
+		username = user;
+		password = pass;
+	}
+	void setWill(const char* topic, uint8_t qos, bool retain, const char* payload);
+	void setCleanSession(bool clean) { cleanSession = clean; }
+	// TLS, with the server certificate pinned by its SHA1 fingerprint, unverified for null
+	void setSecure(bool secure, const uint8_t* fingerprint);
+
+	void onConnect(ConnectCallback callback) { connectCallback = callback; }
+	void onDisconnect(DisconnectCallback callback) { disconnectCallback = callback; }
+	void onMessage(MessageCallback callback) { messageCallback = callback; }
+
+	void connect();
+	// force closes the connection without a DISCONNECT, so the broker publishes the will
+	void disconnect(bool force = false);
+	bool connected() { return mqtt.connected(); }
+	// packet id 1 when sent, 0 when it was not
+	uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload);
+	uint16_t subscribe(const char* topic, uint8_t qos);
+	uint16_t unsubscribe(const char* topic);
+	// reads the incoming messages and notices a lost connection, call from loop()
+	void loop();
+
+private:
+	void closed(MqttDisconnectReason reason);
+
+	WiFiClient plain;
+	BearSSL::WiFiClientSecure tls;
+	BearSSL::Session session;
+	PubSubClient mqtt;
+	bool secure = false;
+	String probedServer;				// host:port the fragment length was probed for
+	bool fragmentAccepted = false;
+	bool wasConnected = false;
+
+	const char* host = nullptr;
+	uint16_t port = 0;
+	const char* clientId = nullptr;
+	const char* username = nullptr;
+	const char* password = nullptr;
+	const char* willTopic = nullptr;
+	uint8_t willQos = 0;
+	bool willRetain = false;
+	const char* willPayload = nullptr;
+	bool cleanSession = true;
+
+	ConnectCallback connectCallback;
+	DisconnectCallback disconnectCallback;
+	MessageCallback messageCallback;
+};
+#endif
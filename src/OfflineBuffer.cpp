@@ -0,0 +1,82 @@
+#include "OfflineBuffer.h"
+
+void OfflineBuffer::add(uint8_t field, float value, uint32_t time)
+{
+	if (field >= fieldCount)
+		return;
+	if ((lastValid & (1UL << field)) && lastValue[field] == value)
+		return;
+	lastValid |= (1UL << field);
+	lastValue[field] = value;
+
+	if (OFFLINE_BUFFER_SIZE == count)
+		mergeOldest();
+
+	Record& r = records[index(count)];
+	r.time = time;
+	r.value = value;
+	r.field = field;
+	r.samples = 1;
+	++count;
+}
+
+void OfflineBuffer::clearLastValues()
+{
+	lastValid = 0;
+}
+
+void OfflineBuffer::pop()
+{
+	if (0 == count)
+		return;
+	head = index(1);
+	--count;
+}
+
+void OfflineBuffer::mergeOldest()
+{
+	uint16_t fieldCounts[32] = {0};
+	uint8_t busiest = 0;
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		uint8_t f = records[index(i)].field;
+		if (++fieldCounts[f] > fieldCounts[busiest])
+			busiest = f;
+	}
+
+	if (fieldCounts[busiest] < 2)
+	{
+		// nothing to merge, drop the oldest record
+		pop();
+		++mergedCount;
+		return;
+	}
+
+	uint16_t first = count;
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		if (records[index(i)].field != busiest)
+			continue;
+		if (first == count)
+		{
+			first = i;
+			continue;
+		}
+
+		// fold the older record into the newer one and close the gap
+		Record& older = records[index(first)];
+		Record& newer = records[index(i)];
+		if (averagedFields & (1UL << busiest))
+		{
+			uint32_t samples = (uint32_t)older.samples + newer.samples;
+			newer.value = (older.value * older.samples + newer.value * newer.samples) / samples;
+			newer.time = older.time + (uint32_t)((uint64_t)(newer.time - older.time) * newer.samples / samples);
+			newer.samples = std::min<uint32_t>(samples, UINT16_MAX);
+		}
+		for (uint16_t j = first; j > 0; --j)
+			records[index(j)] = records[index(j - 1)];
+		pop();
+		++mergedCount;
+		return;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef OFFLINEBUFFER_H
+#define OFFLINEBUFFER_H
+#include <Arduino.h>
+
+// Timestamped field changes recorded while the broker is unreachable.
+// 12 bytes per record: 128 records = 1.5 KB. The MCU reports the temperatures
+// about every 108s (one Settings1 query per 9 query slots of 12s), so one hour
+// offline is ~70 temperature records plus the state transitions.
+// When full, the two oldest records of the most frequent field are merged,
+// weighted by the readings each of them already holds.
+#define OFFLINE_BUFFER_SIZE 128
+
+class OfflineBuffer
+{
+public:
+	struct Record
+	{
+		uint32_t time;	// seconds, TimeLib now()
+		float value;
+		uint8_t field;
+		uint16_t samples;	// readings in value, a merged record is their mean
+	};
+
+	OfflineBuffer(uint8_t fieldCount, uint32_t averagedFields) : fieldCount(fieldCount), averagedFields(averagedFields) {}
+
+	// records the value if it differs from the last one recorded for the field
+	void add(uint8_t field, float value, uint32_t time);
+	void clearLastValues();
+
+	bool isEmpty() const { return 0 == count; }
+	uint16_t size() const { return count; }
+	const Record& front() const { return records[head]; }
+	void pop();
+
+	uint32_t getMergedCount() const { return mergedCount; }
+	void clearMergedCount() { mergedCount = 0; }
+
+private:
+	uint16_t index(uint16_t i) const { return (head + i) % OFFLINE_BUFFER_SIZE; }
+	void mergeOldest();
+
+	Record records[OFFLINE_BUFFER_SIZE];
+	uint16_t head = 0;
+	uint16_t count = 0;
+	uint8_t fieldCount;
+	uint32_t averagedFields;	// fields merged by averaging, all others keep the newer value
+	uint32_t lastValid = 0;
+	float lastValue[32];
+	uint32_t mergedCount = 0;
+};
+#endif
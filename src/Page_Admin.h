@@ -4,10 +4,8 @@ const char PAGE_AdminMainPage[] PROGMEM = R"=====(
 <hr>
 <a href="/status"   style="width:250px"  class="btn btn--m btn--blue" >Status</a><br>
 <a href="/console"   style="width:250px"  class="btn btn--m btn--blue" >Log/Console</a><br>
-<a href="general.html" style="width:250px" class="btn btn--m btn--blue" >General Configuration</a><br>
-<a href="config.html" style="width:250px" class="btn btn--m btn--blue" >Network Configuration</a><br>
+<a href="config.html" style="width:250px" class="btn btn--m btn--blue" >Configuration</a><br>
 <a href="info.html"   style="width:250px"  class="btn btn--m btn--blue" >Network Information</a><br>
-<a href="ntp.html"   style="width:250px"  class="btn btn--m btn--blue" >NTP Settings</a><br>
 <a href="/update"   style="width:250px"  class="btn btn--m btn--blue" >Firmware Update</a><br>
 
 <script>
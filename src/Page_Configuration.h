@@ -0,0 +1,412 @@
+#ifndef PAGE_CONFIGURATION_H
+#define PAGE_CONFIGURATION_H
+
+// general, network and NTP settings on one page, filled from and saved to /api/config
+const char PAGE_Configuration[] PROGMEM = R"=====(
+<meta name="viewport" content="width=device-width, initial-scale=1" />
+<meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
+<link rel="stylesheet" href="style.css" type="text/css" />
+<a href="/"  class="btn btn--s"><</a>&nbsp;&nbsp;<strong>Configuration</strong>
+<hr>
+<form id="cfg">
+<table border="0"  cellspacing="0" cellpadding="3" style="width:310px" >
+<tr><td align="center" colspan="2"><strong id="general">General</strong></td></tr>
+<tr><td align="right">Name of Device:</td><td><input type="text" name="device_name" maxlength="32"></td></tr>
+<tr><td align="right">Password:</td><td><input type="text" name="ota_password" maxlength="32"></td></tr>
+<tr><td align="right">Temperature deadband:</td><td><input type="text" name="temp_deadband" data-num="1" size="4"> &deg;C</td></tr>
+<tr><td align="right">Temperature heartbeat:</td><td><input type="text" name="temp_heartbeat" data-num="1" size="6"> s</td></tr>
+<tr><td align="right">WiFi scan cache:</td><td><input type="text" name="wifi_scan_ttl" data-num="1" size="6"> s</td></tr>
+<tr><td align="right">Capture to flash:</td><td><input type="checkbox" name="capture_flash"> <a href="/api/capture">txt</a> <a href="/api/capture?format=bin">bin</a></td></tr>
+<tr><td align="center" colspan="2"><strong id="network">Network</strong></td></tr>
+<tr><td align="right">SSID:</td><td><input type="text" id="ssid" name="ssid" maxlength="32"></td></tr>
+<tr><td align="right">Password:</td><td><input type="text" name="password" maxlength="32"></td></tr>
+<tr><td align="right">DHCP:</td><td><input type="checkbox" name="dhcp"></td></tr>
+<tr><td align="right">IP:</td><td><input type="text" name="ip" placeholder="192.168.1.100"></td></tr>
+<tr><td align="right">Netmask:</td><td><input type="text" name="netmask" placeholder="255.255.255.0"></td></tr>
+<tr><td align="right">Gateway:</td><td><input type="text" name="gateway" placeholder="192.168.1.254"></td></tr>
+<tr><td align="right">MQTT server:</td><td><input type="text" name="mqtt_server" maxlength="32"></td></tr>
+<tr><td align="right">MQTT port:</td><td><input type="text" name="mqtt_port" maxlength="5"></td></tr>
+<tr><td align="right">MQTT username:</td><td><input type="text" name="mqtt_username" maxlength="32"></td></tr>
+<tr><td align="right">MQTT password:</td><td><input type="text" name="mqtt_password" maxlength="32"></td></tr>
+<tr><td align="right">MQTT prefix:</td><td><input type="text" name="mqtt_prefix" maxlength="32"></td></tr>
+<tr><td align="right">MQTT groups:</td><td><input type="text" name="mqtt_groups" maxlength="63" placeholder="zone1,all"></td></tr>
+<tr><td align="right">MQTT TLS:</td><td><input type="checkbox" name="mqtt_tls"></td></tr>
+<tr><td align="right">MQTT fingerprint:</td><td><input type="text" name="mqtt_fingerprint" placeholder="SHA1, hex"></td></tr>
+<tr><td align="right">Syslog server:</td><td><input type="text" name="syslog_server" placeholder="192.168.1.10"></td></tr>
+<tr><td align="right">Syslog port:</td><td><input type="text" name="syslog_port" data-num="1" size="5" placeholder="514"> (0=disable)</td></tr>
+<tr><td align="center" colspan="2"><strong id="ntp">NTP</strong></td></tr>
+<tr><td align="right">NTP Server:</td><td><input type="text" name="ntp_server" maxlength="32"></td></tr>
+<tr><td align="right">Update:</td><td><input type="text" name="ntp_update" data-num="1" size="3" maxlength="6"> minutes (0=disable)</td></tr>
+<tr><td align="right">Timezone:</td><td><select name="timezone" data-num="1">
+<option value="-120">(GMT-12:00)</option><option value="-110">(GMT-11:00)</option><option value="-100">(GMT-10:00)</option>
+<option value="-90">(GMT-09:00)</option><option value="-80">(GMT-08:00)</option><option value="-70">(GMT-07:00)</option>
+<option value="-60">(GMT-06:00)</option><option value="-50">(GMT-05:00)</option><option value="-40">(GMT-04:00)</option>
+<option value="-35">(GMT-03:30)</option><option value="-30">(GMT-03:00)</option><option value="-20">(GMT-02:00)</option>
+<option value="-10">(GMT-01:00)</option><option value="0">(GMT+00:00)</option><option value="10">(GMT+01:00)</option>
+<option value="20">(GMT+02:00)</option><option value="30">(GMT+03:00)</option><option value="35">(GMT+03:30)</option>
+<option value="40">(GMT+04:00)</option><option value="45">(GMT+04:30)</option><option value="50">(GMT+05:00)</option>
+<option value="55">(GMT+05:30)</option><option value="57">(GMT+05:45)</option><option value="60">(GMT+06:00)</option>
+<option value="65">(GMT+06:30)</option><option value="70">(GMT+07:00)</option><option value="80">(GMT+08:00)</option>
+<option value="90">(GMT+09:00)</option><option value="95">(GMT+09:30)</option><option value="100">(GMT+10:00)</option>
+<option value="110">(GMT+11:00)</option><option value="120">(GMT+12:00)</option><option value="130">(GMT+13:00)</option>
+</select></td></tr>
+<tr><td align="right">Daylight saving:</td><td><input type="checkbox" name="dst"></td></tr>
+<tr><td colspan="2" align="center"><input type="submit" style="width:150px" class="btn btn--m btn--blue" value="Save"></td></tr>
+<tr><td colspan="2" align="center"><div id="result"></div></td></tr>
+</table>
+</form>
+<hr>
+<strong>Connection State:</strong><div id="connectionstate">N/A</div>
+<hr>
+<strong>Networks:</strong><br>
+<table border="0"  cellspacing="3" style="width:310px" >
+<tr><td><div id="networks">Scanning...</div></td></tr>
+<tr><td align="center"><a href="javascript:GetState()" style="width:150px" class="btn btn--m btn--blue">Refresh</a></td></tr>
+</table>
+<script>
+var form = document.getElementById("cfg");
+function request(method, url, body, done)
+{
+	var x = new XMLHttpRequest();
+	x.open(method, url, true);
+	x.onload = function() { done(x.status, x.responseText); };
+	x.send(body);
+}
+function show(values)
+{
+	for (var name in values)
+	{
+		var e = form.elements[name];
+		if (!e) continue;
+		if (e.type == "checkbox") e.checked = values[name];
+		else e.value = values[name];
+	}
+}
+form.onsubmit = function()
+{
+	var values = {};
+	for (var i = 0; i < form.elements.length; i++)
+	{
+		var e = form.elements[i];
+		if (!e.name) continue;
+		values[e.name] = e.type == "checkbox" ? e.checked : e.getAttribute("data-num") ? Number(e.value) : e.value;
+	}
+	request("POST", "/api/config", JSON.stringify(values), function(status, text)
+	{
+		var r = JSON.parse(text);
+		document.getElementById("result").innerHTML = status != 200 ? "Not saved: " + r.error : r.restart ? "Saved, restarting..." : "Saved";
+		if (r.restart) setTimeout(function() { location.reload(); }, 8000);
+	});
+	return false;
+};
+// the network list still comes as "id|value|kind" lines
+function GetState()
+{
+	request("GET", "/admin/connectionstate", null, function(status, text)
+	{
+		text.split("\n").forEach(function(line)
+		{
+			var fields = line.split("|");
+			if (fields[2] == "div") document.getElementById(fields[0]).innerHTML = fields[1];
+		});
+		// poll until the first scan is done
+		if (document.getElementById("networks").innerHTML == "Scanning...") setTimeout(GetState, 2000);
+	});
+}
+function selssid(value)
+{
+	document.getElementById("ssid").value = value;
+}
+request("GET", "/api/config", null, function(status, text) { if (status == 200) show(JSON.parse(text)); });
+setTimeout(GetState, 3000);
+</script>
+)=====";
+
+// "AB:CD:..." or "abcd..." to 20 bytes, anything else but hex digits is skipped
+void parseFingerprint(const String& hex, byte* fingerprint)
+{
+	memset(fingerprint, 0, 20);
+	int nibble = 0;
+	for (unsigned int i = 0; i < hex.length() && nibble < 40; i++)
+	{
+		if (!isxdigit(hex[i]))
+			continue;
+		fingerprint[nibble / 2] |= h2int(hex[i]) << (nibble % 2 ? 0 : 4);
+		nibble++;
+	}
+}
+
+String formatFingerprint(const byte* fingerprint)
+{
+	char hex[61] = {0};
+	for (int i = 0; i < 20; i++)
+		sprintf(hex + i * 3, i < 19 ? "%02X:" : "%02X", fingerprint[i]);
+	return String(hex);
+}
+
+// /api/config from a copy of the config, one section per chunk
+class ConfigJsonResponse : public ChunkedResponse
+{
+public:
+	ConfigJsonResponse() : cfg(config) {}
+
+protected:
+	bool next() override
+	{
+		switch (step++)
+		{
+		case 0:
+			printString("{\"device_name\":", cfg.DeviceName);
+			printString(",\"ota_password\":", cfg.OTApwd);
+			print(",\"temp_deadband\":");
+			print(cfg.temp_deadband / 100.f);
+			printf(",\"temp_heartbeat\":%ld,\"wifi_scan_ttl\":%ld", cfg.temp_heartbeat, cfg.wifi_scan_ttl);
+			printf(",\"capture_flash\":%s", cfg.capture_flash ? "true" : "false");
+			return true;
+		case 1:
+			printString(",\"ssid\":", cfg.ssid);
+			printString(",\"password\":", cfg.password);
+			printf(",\"dhcp\":%s", cfg.dhcp ? "true" : "false");
+			printAddress(",\"ip\":", cfg.IP);
+			printAddress(",\"netmask\":", cfg.Netmask);
+			printAddress(",\"gateway\":", cfg.Gateway);
+			return true;
+		case 2:
+			printString(",\"mqtt_server\":", cfg.mqtt_server);
+			printString(",\"mqtt_port\":", cfg.mqtt_port);
+			printString(",\"mqtt_username\":", cfg.mqtt_username);
+			printString(",\"mqtt_password\":", cfg.mqtt_password);
+			printString(",\"mqtt_prefix\":", cfg.mqtt_prefix);
+			printString(",\"mqtt_groups\":", cfg.mqtt_groups);
+			printf(",\"mqtt_tls\":%s", cfg.mqtt_tls ? "true" : "false");
+			printString(",\"mqtt_fingerprint\":", formatFingerprint(cfg.mqtt_fingerprint).c_str());
+			printAddress(",\"syslog_server\":", cfg.syslog_server);
+			printf(",\"syslog_port\":%ld", cfg.syslog_port);
+			return true;
+		default:
+			printString(",\"ntp_server\":", cfg.ntpServerName);
+			printf(",\"ntp_update\":%ld,\"timezone\":%ld,\"dst\":%s}", cfg.Update_Time_Via_NTP_Every, cfg.timeZone,
+			       cfg.isDayLightSaving ? "true" : "false");
+			return false;
+		}
+	}
+
+private:
+	void printString(const char* key, const char* value)
+	{
+		print(key);
+		printJsonString(*this, value);
+	}
+	void printAddress(const char* key, const byte* address)
+	{
+		printf("%s\"%u.%u.%u.%u\"", key, address[0], address[1], address[2], address[3]);
+	}
+
+	strConfig cfg;
+	int step = 0;
+};
+
+void send_config_json(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	AsyncWebServerResponse* response = ChunkedResponse::begin(request, "application/json", new ConfigJsonResponse());
+	response->addHeader("Cache-Control", "no-store");
+	request->send(response);
+}
+
+//
+//   SAVE THE VALUES POSTED TO /api/config
+//
+
+// each reader leaves the value alone when the key is missing and returns false when it does not fit
+template <size_t N>
+static bool readConfigValue(JsonObjectConst values, const char* key, char (&value)[N], bool& changed)
+{
+	JsonVariantConst v = values[key];
+	if (v.isNull())
+		return true;
+	if (!v.is<const char*>() || strlen(v.as<const char*>()) > N - 1)
+		return false;
+	if (0 != strcmp(value, v.as<const char*>()))
+	{
+		strcpy(value, v.as<const char*>());
+		changed = true;
+	}
+	return true;
+}
+
+static bool readConfigValue(JsonObjectConst values, const char* key, long& value, long minValue, long maxValue, bool& changed)
+{
+	JsonVariantConst v = values[key];
+	if (v.isNull())
+		return true;
+	if (!v.is<long>() || v.as<long>() < minValue || v.as<long>() > maxValue)
+		return false;
+	changed |= (value != v.as<long>());
+	value = v.as<long>();
+	return true;
+}
+
+static bool readConfigValue(JsonObjectConst values, const char* key, boolean& value, bool& changed)
+{
+	JsonVariantConst v = values[key];
+	if (v.isNull())
+		return true;
+	if (!v.is<bool>())
+		return false;
+	changed |= (value != v.as<bool>());
+	value = v.as<bool>();
+	return true;
+}
+
+// "a.b.c.d"
+static bool readConfigAddress(JsonObjectConst values, const char* key, byte* address, bool& changed)
+{
+	JsonVariantConst v = values[key];
+	if (v.isNull())
+		return true;
+	unsigned int a[4];
+	char end;
+	if (!v.is<const char*>() || 4 != sscanf(v.as<const char*>(), "%u.%u.%u.%u%c", &a[0], &a[1], &a[2], &a[3], &end))
+		return false;
+	for (int i = 0; i < 4; i++)
+	{
+		if (a[i] > 255)
+			return false;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		changed |= (address[i] != a[i]);
+		address[i] = a[i];
+	}
+	return true;
+}
+
+// a TCP port kept as text, empty while MQTT is not set up
+static bool readConfigPort(JsonObjectConst values, const char* key, char (&port)[6], bool& changed)
+{
+	JsonVariantConst v = values[key];
+	if (v.isNull())
+		return true;
+	if (!v.is<const char*>())
+		return false;
+	const char* text = v.as<const char*>();
+	if (*text)
+	{
+		size_t len = strspn(text, "0123456789");
+		if (0 == len || text[len] || len > 5 || atol(text) < 1 || atol(text) > 65535)
+			return false;
+	}
+	return readConfigValue(values, key, port, changed);
+}
+
+static void sendConfigError(AsyncWebServerRequest* request, const char* key)
+{
+	request->send(400, "application/json", String("{\"error\":\"invalid ") + key + "\"}");
+}
+
+void receive_config_json(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	if (!request->_tempObject)
+	{
+		request->send(400, "application/json", "{\"error\":\"missing or too large body\"}");
+		return;
+	}
+	DynamicJsonDocument doc(1536);
+	if (deserializeJson(doc, (const char*)request->_tempObject) || !doc.is<JsonObject>())
+	{
+		request->send(400, "application/json", "{\"error\":\"invalid JSON\"}");
+		return;
+	}
+	JsonObjectConst values = doc.as<JsonObject>();
+
+	// checked on a copy, a bad value leaves the config untouched
+	strConfig cfg = config;
+	bool saved = false;                // read where it is used, nothing to apply
+	bool filter = false, name = false, password = false, mqtt = false, ntp = false, capture = false, syslog = false;
+	bool network = false;              // needs a new WiFi association, or a pinned certificate to be dropped
+	if (!values["temp_deadband"].isNull())
+	{
+		// kept in 1/100 degree
+		float deadband = values["temp_deadband"].as<float>();
+		if (!values["temp_deadband"].is<float>() || deadband < 0 || deadband > 5)
+			return sendConfigError(request, "temp_deadband");
+		long temp_deadband = (long)(deadband * 100 + .5f);
+		filter |= (temp_deadband != cfg.temp_deadband);
+		cfg.temp_deadband = temp_deadband;
+	}
+
+	const char* bad = nullptr;
+	if (!readConfigValue(values, "device_name", cfg.DeviceName, name)) bad = "device_name";
+	else if (!readConfigValue(values, "ota_password", cfg.OTApwd, password)) bad = "ota_password";
+	else if (!readConfigValue(values, "temp_heartbeat", cfg.temp_heartbeat, 1, 86400, filter)) bad = "temp_heartbeat";
+	else if (!readConfigValue(values, "wifi_scan_ttl", cfg.wifi_scan_ttl, 1, 3600, saved)) bad = "wifi_scan_ttl";
+	else if (!readConfigValue(values, "capture_flash", cfg.capture_flash, capture)) bad = "capture_flash";
+	else if (!readConfigValue(values, "ssid", cfg.ssid, network)) bad = "ssid";
+	else if (!readConfigValue(values, "password", cfg.password, network)) bad = "password";
+	else if (!readConfigValue(values, "dhcp", cfg.dhcp, network)) bad = "dhcp";
+	else if (!readConfigAddress(values, "ip", cfg.IP, network)) bad = "ip";
+	else if (!readConfigAddress(values, "netmask", cfg.Netmask, network)) bad = "netmask";
+	else if (!readConfigAddress(values, "gateway", cfg.Gateway, network)) bad = "gateway";
+	else if (!readConfigValue(values, "mqtt_server", cfg.mqtt_server, mqtt)) bad = "mqtt_server";
+	else if (!readConfigPort(values, "mqtt_port", cfg.mqtt_port, mqtt)) bad = "mqtt_port";
+	else if (!readConfigValue(values, "mqtt_username", cfg.mqtt_username, mqtt)) bad = "mqtt_username";
+	else if (!readConfigValue(values, "mqtt_password", cfg.mqtt_password, mqtt)) bad = "mqtt_password";
+	else if (!readConfigValue(values, "mqtt_prefix", cfg.mqtt_prefix, mqtt)) bad = "mqtt_prefix";
+	else if (!readConfigValue(values, "mqtt_groups", cfg.mqtt_groups, mqtt)) bad = "mqtt_groups";
+	else if (!readConfigValue(values, "mqtt_tls", cfg.mqtt_tls, network)) bad = "mqtt_tls";
+	else if (!readConfigAddress(values, "syslog_server", cfg.syslog_server, syslog)) bad = "syslog_server";
+	else if (!readConfigValue(values, "syslog_port", cfg.syslog_port, 0, 65535, syslog)) bad = "syslog_port";
+	else if (!readConfigValue(values, "ntp_server", cfg.ntpServerName, ntp)) bad = "ntp_server";
+	else if (!readConfigValue(values, "ntp_update", cfg.Update_Time_Via_NTP_Every, 0, 999999, saved)) bad = "ntp_update";
+	else if (!readConfigValue(values, "timezone", cfg.timeZone, -120, 130, ntp)) bad = "timezone";
+	else if (!readConfigValue(values, "dst", cfg.isDayLightSaving, ntp)) bad = "dst";
+	if (bad)
+		return sendConfigError(request, bad);
+	if (capture && cfg.capture_flash && !::capture.isMounted())
+	{
+		// mounting may format the partition, too long for the web server; setup() tries again
+		request->send(409, "application/json", "{\"error\":\"no file system, restart to format it\"}");
+		return;
+	}
+	if (!values["mqtt_fingerprint"].isNull())
+	{
+		if (!values["mqtt_fingerprint"].is<const char*>())
+			return sendConfigError(request, "mqtt_fingerprint");
+		byte fingerprint[20];
+		parseFingerprint(values["mqtt_fingerprint"].as<const char*>(), fingerprint);
+		// the MQTT client can add a fingerprint but not forget one
+		network |= (0 != memcmp(fingerprint, cfg.mqtt_fingerprint, sizeof(fingerprint)));
+		memcpy(cfg.mqtt_fingerprint, fingerprint, sizeof(fingerprint));
+	}
+	if (cfg.mqtt_tls)
+	{
+		// all zero would be pinned as is, and no broker matches it
+		bool pinned = false;
+		for (byte b : cfg.mqtt_fingerprint)
+			pinned |= (0 != b);
+		if (!pinned)
+			return sendConfigError(request, "mqtt_fingerprint");
+	}
+
+	config = cfg;
+	if (saved || filter || name || password || mqtt || ntp || capture || syslog || network)
+		httpConfigSavePending = true;
+	if (network)
+	{
+		httpRestartAt = millis() + 1000;	// after the answer went out
+	}
+	else
+	{
+		httpConfigChanged |= (filter ? CONFIG_CHANGED_FILTER : 0) | (name ? CONFIG_CHANGED_NAME : 0) |
+		                     (password ? CONFIG_CHANGED_PASSWORD : 0) | (mqtt ? CONFIG_CHANGED_MQTT : 0) |
+		                     (ntp ? CONFIG_CHANGED_NTP : 0) | (capture ? CONFIG_CHANGED_CAPTURE : 0) |
+		                     (syslog ? CONFIG_CHANGED_SYSLOG : 0);
+	}
+	request->send(200, "application/json", network ? "{\"saved\":true,\"restart\":true}" : "{\"saved\":true,\"restart\":false}");
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PAGE_CONSOLE_H
+#define PAGE_CONSOLE_H
+
+const char PAGE_Console[] PROGMEM = R"=====(
+<meta name="viewport" content="width=device-width, initial-scale=1" />
+<meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
+<a href="/"  class="btn btn--s"><</a>&nbsp;&nbsp;<strong>Console</strong>
+<hr>
+<form method='POST' onsubmit='return send();'>
+<textarea id='console' style='width:100%;height:calc(100% - 75px);'></textarea>
+<br/>
+<input type='text' id='cmd' name='cmd' style='width:calc(100% - 100px);'></input><input type=submit value='send' style='width:100px;'></input>
+<br/><label><input type='checkbox' id='decode'> decode frames</label>
+</form>
+<script>
+
+var next = 0;
+
+// first line is the cursor for the next poll, the rest are new log lines
+function tail()
+{
+	var decode = document.getElementById('decode').checked ? "&decode=1" : "";
+	microAjax("/api/log?since=" + next + decode, function(res)
+	{
+		var lines = res.split(String.fromCharCode(10));
+		if (lines.length > 1)
+		{
+			next = parseInt(lines.shift());
+			var text = lines.join(String.fromCharCode(10));
+			if (text.length > 0)
+			{
+				var c = document.getElementById('console');
+				c.value += text;
+				c.scrollTop = c.scrollHeight;
+			}
+		}
+		setTimeout(tail, 1000);
+	});
+}
+
+function send()
+{
+	var cmd = document.getElementById('cmd');
+	microAjax("/console", function(res) {}, "cmd=" + encodeURIComponent(cmd.value));
+	cmd.value = "";
+	return false;
+}
+
+window.onload = function ()
+{
+	load("style.css","css", function() 
+	{
+		load("microajax.js","js", function() 
+		{
+				tail();
+		});
+	});
+}
+function load(e,t,n){if("js"==t){var a=document.createElement("script");a.src=e,a.type="text/javascript",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}else if("css"==t){var a=document.createElement("link");a.href=e,a.rel="stylesheet",a.type="text/css",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}}
+
+</script>
+)=====";
+
+#endif
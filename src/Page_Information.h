@@ -47,15 +47,14 @@ function load(e,t,n){if("js"==t){var a=document.createElement("script");a.src=e,
 // FILL WITH INFOMATION
 // 
 
-void send_information_values_html ()
+void send_information_values_html(AsyncWebServerRequest* request)
 {
-  String values ="";
-
-  values += "x_ssid|" + (String)WiFi.SSID() +  "|div\n";
-  values += "x_ip|" +  (String) WiFi.localIP()[0] + "." +  (String) WiFi.localIP()[1] + "." +  (String) WiFi.localIP()[2] + "." + (String) WiFi.localIP()[3] +  "|div\n";
-  values += "x_gateway|" +  (String) WiFi.gatewayIP()[0] + "." +  (String) WiFi.gatewayIP()[1] + "." +  (String) WiFi.gatewayIP()[2] + "." + (String) WiFi.gatewayIP()[3] +  "|div\n";
-  values += "x_netmask|" +  (String) WiFi.subnetMask()[0] + "." +  (String) WiFi.subnetMask()[1] + "." +  (String) WiFi.subnetMask()[2] + "." + (String) WiFi.subnetMask()[3] +  "|div\n";
-  values += "x_mac|" + GetMacAddress() +  "|div\n";
-  server.send ( 200, "text/plain", values);
+  AsyncResponseStream* out = request->beginResponseStream("text/plain");
+  printValue(*out, "x_ssid", WiFi.SSID(), "div");
+  printValue(*out, "x_ip", WiFi.localIP().toString(), "div");
+  printValue(*out, "x_gateway", WiFi.gatewayIP().toString(), "div");
+  printValue(*out, "x_netmask", WiFi.subnetMask().toString(), "div");
+  printValue(*out, "x_mac", GetMacAddress(), "div");
+  request->send(out);
 }
 #endif
\ No newline at end of file
@@ -1,249 +1,87 @@
-const char PAGE_NetworkConfiguration[] PROGMEM = R"=====(
-<meta name="viewport" content="width=device-width, initial-scale=1" />
-<meta http-equiv="Content-Type" content="text/html; charset=utf-8" />
-<a href="/"  class="btn btn--s"><</a>&nbsp;&nbsp;<strong>Network Configuration</strong>
-<hr>
-Connect to Router with these settings:<br>
-<form action="" method="get">
-<table border="0"  cellspacing="0" cellpadding="3" style="width:310px" >
-<tr><td align="right">SSID:</td><td><input type="text" id="ssid" name="ssid" value=""></td></tr>
-<tr><td align="right">Password:</td><td><input type="text" id="password" name="password" value=""></td></tr>
-<tr><td align="right">DHCP:</td><td><input type="checkbox" id="dhcp" name="dhcp"></td></tr>
-<tr><td align="right">IP:     </td><td><input type="text" id="ip_0" name="ip_0" size="3">.<input type="text" id="ip_1" name="ip_1" size="3">.<input type="text" id="ip_2" name="ip_2" size="3">.<input type="text" id="ip_3" name="ip_3" value="" size="3"></td></tr>
-<tr><td align="right">Netmask:</td><td><input type="text" id="nm_0" name="nm_0" size="3">.<input type="text" id="nm_1" name="nm_1" size="3">.<input type="text" id="nm_2" name="nm_2" size="3">.<input type="text" id="nm_3" name="nm_3" size="3"></td></tr>
-<tr><td align="right">Gateway:</td><td><input type="text" id="gw_0" name="gw_0" size="3">.<input type="text" id="gw_1" name="gw_1" size="3">.<input type="text" id="gw_2" name="gw_2" size="3">.<input type="text" id="gw_3" name="gw_3" size="3"></td></tr>
-<tr><td align="center" colspan="2">MQTT DATA:</td></tr>
-<tr><td align="right">MQTT server:</td><td><input type="text" id="mqtt_server" name="mqtt_server" value=""></td></tr>
-<tr><td align="right">MQTT port:</td><td><input type="text" id="mqtt_port" name="mqtt_port" value=""></td></tr>
-<tr><td align="right">MQTT username:</td><td><input type="text" id="mqtt_username" name="mqtt_username"></td></tr>
-<tr><td align="right">MQTT password:</td><td><input type="text" id="mqtt_password" name="mqtt_password" ></td></tr>
-<tr><td align="right">MQTT prefix:</td><td><input type="text" id="mqtt_prefix" name="mqtt_prefix" ></td></tr>
-<tr><td colspan="2" align="center"><input type="submit" style="width:150px" class="btn btn--m btn--blue" value="Save"></td></tr>
-</table>
-</form>
-<hr>
-<strong>Connection State:</strong><div id="connectionstate">N/A</div>
-<hr>
-<strong>Networks:</strong><br>
-<table border="0"  cellspacing="3" style="width:310px" >
-<tr><td><div id="networks">Scanning...</div></td></tr>
-<tr><td align="center"><a href="javascript:GetState()" style="width:150px" class="btn btn--m btn--blue">Refresh</a></td></tr>
-</table>
-<!-- MQTT settings  -->
-<!-- <hr>
-MQTT settings:<br>
-<form name="MQTT_form" action="" method="get">
-<table border="0"  cellspacing="0" cellpadding="3" style="width:310px" >
-
-
-<tr><td colspan="2" align="center"><input type="submit" style="width:150px" class="btn btn--m btn--blue" value="Save"></td></tr>
-</table>
-</form>
--->
-
-<script>
-
-function GetState()
-{
-	setValues("/admin/connectionstate");
-}
-function selssid(value)
-{
-	document.getElementById("ssid").value = value;
-}
-
-
-window.onload = function ()
-{
-	load("style.css","css", function()
-	{
-		load("microajax.js","js", function()
-		{
-					setValues("/admin/values");
-					setTimeout(GetState,3000);
-		});
-	});
-}
-function load(e,t,n){if("js"==t){var a=document.createElement("script");a.src=e,a.type="text/javascript",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}else if("css"==t){var a=document.createElement("link");a.href=e,a.rel="stylesheet",a.type="text/css",a.async=!1,a.onload=function(){n()},document.getElementsByTagName("head")[0].appendChild(a)}}
-
-
-
-
-</script>
-
-
-)=====";
-
-const char PAGE_WaitAndReload[] PROGMEM = R"=====(
-<meta http-equiv="refresh" content="5; URL=config.html">
-Please Wait....Configuring and Restarting.
-)=====";
-
-
 //
-//  SEND HTML PAGE OR IF A FORM SUMBITTED VALUES, PROCESS THESE VALUES
+//   FILL THE PAGE WITH NETWORKSTATE & NETWORKS
 //
 
-// Check the Values is between 0-255
-boolean checkRange(String Value)
-{
-  if (Value.toInt() < 0 || Value.toInt() > 255)
-  {
-    return false;
-  }
-  else
-  {
-    return true;
-  }
-}
-
-void send_network_configuration_html()
+// networks from the scan cache, one table row per chunk
+class ConnectionStateResponse : public ChunkedResponse
 {
-	if(config.OTApwd.length() > 0)
-	{
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	}
+public:
+	ConnectionStateResponse() : generation(wifiScan.getGeneration()) {}
 
-	if (server.args() > 0 )  // Save Settings
+protected:
+	bool next() override
 	{
-		String temp = "";
-		config.dhcp = false;
-		for ( uint8_t i = 0; i < server.args(); i++ ) {
-			if (server.argName(i) == "ssid") config.ssid =   urldecode(server.arg(i));
-			if (server.argName(i) == "password") config.password =    urldecode(server.arg(i));
-			if (server.argName(i) == "ip_0") if (checkRange(server.arg(i))) 	config.IP[0] =  server.arg(i).toInt();
-			if (server.argName(i) == "ip_1") if (checkRange(server.arg(i))) 	config.IP[1] =  server.arg(i).toInt();
-			if (server.argName(i) == "ip_2") if (checkRange(server.arg(i))) 	config.IP[2] =  server.arg(i).toInt();
-			if (server.argName(i) == "ip_3") if (checkRange(server.arg(i))) 	config.IP[3] =  server.arg(i).toInt();
-			if (server.argName(i) == "nm_0") if (checkRange(server.arg(i))) 	config.Netmask[0] =  server.arg(i).toInt();
-			if (server.argName(i) == "nm_1") if (checkRange(server.arg(i))) 	config.Netmask[1] =  server.arg(i).toInt();
-			if (server.argName(i) == "nm_2") if (checkRange(server.arg(i))) 	config.Netmask[2] =  server.arg(i).toInt();
-			if (server.argName(i) == "nm_3") if (checkRange(server.arg(i))) 	config.Netmask[3] =  server.arg(i).toInt();
-			if (server.argName(i) == "gw_0") if (checkRange(server.arg(i))) 	config.Gateway[0] =  server.arg(i).toInt();
-			if (server.argName(i) == "gw_1") if (checkRange(server.arg(i))) 	config.Gateway[1] =  server.arg(i).toInt();
-			if (server.argName(i) == "gw_2") if (checkRange(server.arg(i))) 	config.Gateway[2] =  server.arg(i).toInt();
-			if (server.argName(i) == "gw_3") if (checkRange(server.arg(i))) 	config.Gateway[3] =  server.arg(i).toInt();
-			if (server.argName(i) == "dhcp") config.dhcp = true;
-			//mqtt data
-			if (server.argName(i) == "mqtt_server") config.mqtt_server =   urldecode(server.arg(i));
-			if (server.argName(i) == "mqtt_port") config.mqtt_port =   urldecode(server.arg(i));
-			if (server.argName(i) == "mqtt_username") config.mqtt_username =   urldecode(server.arg(i));
-			if (server.argName(i) == "mqtt_password") config.mqtt_password =   urldecode(server.arg(i));
-			if (server.argName(i) == "mqtt_prefix") config.mqtt_prefix =   urldecode(server.arg(i));
-			
+		if (0 == row)
+		{
+			printHeader();
+			++row;
+			return wifiScan.hasResults() && wifiScan.getCount() > 0;
+		}
+		// a scan finished while streaming, the rows left belong to other results
+		if (wifiScan.getGeneration() != generation || row > wifiScan.getCount())
+		{
+			print("</table>|div\n");
+			return false;
 		}
-		 server.send_P ( 200, "text/html", PAGE_WaitAndReload );
-		WriteConfig();
-		ESP.restart();
-	}
-	else
-	{
-		server.send_P ( 200, "text/html", PAGE_NetworkConfiguration );
-	}
-}
-
-
-
-//
-//   FILL THE PAGE WITH VALUES
-//
 
-void send_network_configuration_values_html()
-{
-	if(config.OTApwd.length() > 0)
-	{
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
+		const WifiScan::Network& network = wifiScan.getNetwork(row - 1);
+		int quality=0;
+		if(network.rssi <= -100)
+		{
+				quality = 0;
+		}
+		else if(network.rssi >= -50)
+		{
+				quality = 100;
+		}
+		else
+		{
+			quality = 2 * (network.rssi + 100);
+		}
+		printf("<tr><td><a href='javascript:selssid(\"%s\")'>%s</a></td><td>%d%%</td><td>%s</td></tr>", network.ssid, network.ssid, quality, network.encrypted ? "*" : " ");
+		++row;
+		return true;
 	}
 
-	String values ="";
-
-	values += "ssid|" + (String) config.ssid + "|input\n";
-	values += "password|" +  (String) config.password + "|input\n";
-	values += "ip_0|" +  (String) config.IP[0] + "|input\n";
-	values += "ip_1|" +  (String) config.IP[1] + "|input\n";
-	values += "ip_2|" +  (String) config.IP[2] + "|input\n";
-	values += "ip_3|" +  (String) config.IP[3] + "|input\n";
-	values += "nm_0|" +  (String) config.Netmask[0] + "|input\n";
-	values += "nm_1|" +  (String) config.Netmask[1] + "|input\n";
-	values += "nm_2|" +  (String) config.Netmask[2] + "|input\n";
-	values += "nm_3|" +  (String) config.Netmask[3] + "|input\n";
-	values += "gw_0|" +  (String) config.Gateway[0] + "|input\n";
-	values += "gw_1|" +  (String) config.Gateway[1] + "|input\n";
-	values += "gw_2|" +  (String) config.Gateway[2] + "|input\n";
-	values += "gw_3|" +  (String) config.Gateway[3] + "|input\n";
-	values += "dhcp|" +  (String) (config.dhcp ? "checked" : "") + "|chk\n";
-	//mqtt data
-	values += "mqtt_server|" +  (String) config.mqtt_server + "|input\n";
-	values += "mqtt_port|" +  (String) config.mqtt_port + "|input\n";
-	values += "mqtt_username|" +  (String) config.mqtt_username + "|input\n";
-	values += "mqtt_password|" +  (String) config.mqtt_password + "|input\n";
-	values += "mqtt_prefix|" +  (String) config.mqtt_prefix + "|input\n";
-			
-	server.send ( 200, "text/plain", values);
-}
-
-
-//
-//   FILL THE PAGE WITH NETWORKSTATE & NETWORKS
-//
-
-void send_connection_state_values_html()
-{
-	if(config.OTApwd.length() > 0)
+private:
+	void printHeader()
 	{
-  	  if(!server.authenticate("admin", config.OTApwd.c_str()))
-        return server.requestAuthentication();
-	}
-
-	String state = "N/A";
-	String Networks = "";
-	if (WiFi.status() == 0) state = "Idle";
-	else if (WiFi.status() == 1) state = "NO SSID AVAILBLE";
-	else if (WiFi.status() == 2) state = "SCAN COMPLETED";
-	else if (WiFi.status() == 3) state = "CONNECTED";
-	else if (WiFi.status() == 4) state = "CONNECT FAILED";
-	else if (WiFi.status() == 5) state = "CONNECTION LOST";
-	else if (WiFi.status() == 6) state = "DISCONNECTED";
-
-
-
-	 int n = WiFi.scanNetworks();
-
-	 if (n == 0)
-	 {
-		 Networks = "<font color='#FF0000'>No networks found!</font>";
-	 }
-	else
-    {
-
-
-		Networks = "Found " +String(n) + " Networks<br>";
-		Networks += "<table border='0' cellspacing='0' cellpadding='3'>";
-		Networks += "<tr bgcolor='#DDDDDD' ><td><strong>Name</strong></td><td><strong>Quality</strong></td><td><strong>Enc</strong></td><tr>";
-		for (int i = 0; i < n; ++i)
+		const char* state = "N/A";
+		if (WiFi.status() == 0) state = "Idle";
+		else if (WiFi.status() == 1) state = "NO SSID AVAILBLE";
+		else if (WiFi.status() == 2) state = "SCAN COMPLETED";
+		else if (WiFi.status() == 3) state = "CONNECTED";
+		else if (WiFi.status() == 4) state = "CONNECT FAILED";
+		else if (WiFi.status() == 5) state = "CONNECTION LOST";
+		else if (WiFi.status() == 6) state = "DISCONNECTED";
+		printValue(*this, "connectionstate", state, "div");
+
+		print("networks|");
+		if (!wifiScan.hasResults())
+		{
+			print("Scanning...|div\n");
+		}
+		else if (wifiScan.getCount() == 0)
 		{
-			int quality=0;
-			if(WiFi.RSSI(i) <= -100)
-			{
-					quality = 0;
-			}
-			else if(WiFi.RSSI(i) >= -50)
-			{
-					quality = 100;
-			}
-			else
-			{
-				quality = 2 * (WiFi.RSSI(i) + 100);
-			}
-			Networks += "<tr><td><a href='javascript:selssid(\""  +  String(WiFi.SSID(i))  + "\")'>"  +  String(WiFi.SSID(i))  + "</a></td><td>" +  String(quality) + "%</td><td>" +  String((WiFi.encryptionType(i) == ENC_TYPE_NONE)?" ":"*")  + "</td></tr>";
+			print("<font color='#FF0000'>No networks found!</font>|div\n");
+		}
+		else
+		{
+			printf("Found %d Networks<br>", wifiScan.getCount());
+			print("<table border='0' cellspacing='0' cellpadding='3'>");
+			print("<tr bgcolor='#DDDDDD' ><td><strong>Name</strong></td><td><strong>Quality</strong></td><td><strong>Enc</strong></td><tr>");
 		}
-		Networks += "</table>";
 	}
 
-	String values ="";
-	values += "connectionstate|" +  state + "|div\n";
-	values += "networks|" +  Networks + "|div\n";
-	server.send ( 200, "text/plain", values);
+	uint32_t generation;
+	uint8_t row = 0;
+};
+
+void send_connection_state_values_html(AsyncWebServerRequest* request)
+{
+	if (!httpAuthenticate(request))
+		return;
+	// answered from the cache, an outdated one is refreshed in the background for the next poll
+	wifiScan.refresh(config.wifi_scan_ttl * 1000UL);
+	ChunkedResponse::send(request, "text/plain", new ConnectionStateResponse());
 }
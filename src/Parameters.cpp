@@ -1,158 +1,191 @@
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <stddef.h>
 #include "Parameters.h"
 
+static_assert(sizeof(strConfig) <= CONFIG_EEPROM_SIZE, "the config does not fit the EEPROM area");
 
-strConfig config;
+#define CONFIG_HEADER_SIZE (offsetof(strConfig, crc) + sizeof(uint32_t))
 
-//  Auxiliar function to handle EEPROM
-// EEPROM-parameters
-void EEPROMWritelong(int address, long value) {
-    byte four = (value & 0xFF);
-    byte three = ((value >> 8) & 0xFF);
-    byte two = ((value >> 16) & 0xFF);
-    byte one = ((value >> 24) & 0xFF);
+strConfig config;
 
-    //Write the 4 bytes into the eeprom memory.
-    EEPROM.write(address, four);
-    EEPROM.write(address + 1, three);
-    EEPROM.write(address + 2, two);
-    EEPROM.write(address + 3, one);
+// CRC-32 (IEEE), a nibble at a time
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
 }
 
-long EEPROMReadlong(long address){
-    //Read the 4 bytes from the eeprom memory.
-    long four = EEPROM.read(address);
-    long three = EEPROM.read(address + 1);
-    long two = EEPROM.read(address + 2);
-    long one = EEPROM.read(address + 3);
-
-    //Return the recomposed long by using bitshift.
-    return ((four << 0) & 0xFF) + ((three << 8) & 0xFFFF) + ((two << 16) & 0xFFFFFF) + ((one << 24) & 0xFFFFFFFF);
+static uint32_t configCrc(const uint8_t* blob, uint16_t size)
+{
+  return crc32(blob + CONFIG_HEADER_SIZE, size - CONFIG_HEADER_SIZE);
 }
 
-void WriteStringToEEPROM(int beginaddress, String string){
-    char  charBuf[string.length() + 1];
-    string.toCharArray(charBuf, string.length() + 1);
-    for (unsigned int t =  0; t < sizeof(charBuf); t++)
+// values a blob of an older layout did not have, or that were never written
+static void configSanitize()
+{
+  if (config.temp_deadband < 0 || config.temp_deadband > 500)
+    config.temp_deadband = 20;
+  if (config.temp_heartbeat <= 0 || config.temp_heartbeat > 86400)
+    config.temp_heartbeat = 600;
+  if (config.wifi_scan_ttl <= 0 || config.wifi_scan_ttl > 3600)
+    config.wifi_scan_ttl = 60;
+  if (config.syslog_port < 0 || config.syslog_port > 65535)
+    config.syslog_port = 0;
+  // empty, or 1..65535 in digits like /config takes it
+  long mqttPort = 0;
+  for (unsigned int i = 0; config.mqtt_port[i]; i++)
+  {
+    if (!isdigit(config.mqtt_port[i]))
     {
-      EEPROM.write(beginaddress + t, charBuf[t]);
+      mqttPort = -1;
+      break;
     }
-}
-
-String  ReadStringFromEEPROM(int beginaddress){
-    volatile byte counter = 0;
-    char rChar;
-    String retString = "";
-    while (1)
+    mqttPort = mqttPort * 10 + (config.mqtt_port[i] - '0');
+  }
+  if (mqttPort < 0 || mqttPort > 65535 || (0 == mqttPort && config.mqtt_port[0]))
+    config.mqtt_port[0] = 0;
+  for (unsigned int i = 0; config.mqtt_groups[i]; i++)
+  {
+    if (!isprint(config.mqtt_groups[i]))
     {
-      rChar = EEPROM.read(beginaddress + counter);
-      if (rChar == 0) break;
-      if (counter > 31) break;
-      counter++;
-      retString.concat(rChar);
+      config.mqtt_groups[0] = 0;
+      break;
     }
-    return retString;
+  }
 }
 
-  void WriteConfig()
-  {
-    EEPROM.write(0, 'C');
-    EEPROM.write(1, 'F');
-    EEPROM.write(2, 'G');
-
-    EEPROM.write(16, config.dhcp);
-    EEPROM.write(17, config.isDayLightSaving);
-
-    EEPROMWritelong(18, config.Update_Time_Via_NTP_Every); // 4 Byte
-    EEPROMWritelong(22, config.timeZone); // 4 Byte
+//
+// The byte-wise "CFG" layout of earlier firmware, only read to migrate it
+//
 
-    EEPROM.write(32, config.IP[0]);
-    EEPROM.write(33, config.IP[1]);
-    EEPROM.write(34, config.IP[2]);
-    EEPROM.write(35, config.IP[3]);
+static long legacyReadLong(int address)
+{
+  const uint8_t* p = EEPROM.getConstDataPtr() + address;
+  return (long)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
 
-    EEPROM.write(36, config.Netmask[0]);
-    EEPROM.write(37, config.Netmask[1]);
-    EEPROM.write(38, config.Netmask[2]);
-    EEPROM.write(39, config.Netmask[3]);
+// up to maxLength characters or the first NUL
+static void legacyReadString(int address, char* out, size_t size, size_t maxLength = 32)
+{
+  const uint8_t* p = EEPROM.getConstDataPtr() + address;
+  size_t len = 0;
+  while (len < maxLength && len < size - 1 && p[len])
+    len++;
+  memcpy(out, p, len);
+  out[len] = 0;
+}
 
-    EEPROM.write(40, config.Gateway[0]);
-    EEPROM.write(41, config.Gateway[1]);
-    EEPROM.write(42, config.Gateway[2]);
-    EEPROM.write(43, config.Gateway[3]);
+static boolean ReadLegacyConfig()
+{
+  const uint8_t* eeprom = EEPROM.getConstDataPtr();
+  if (eeprom[0] != 'C' || eeprom[1] != 'F' || eeprom[2] != 'G')
+    return false;
+
+  memset(&config, 0, sizeof(config));
+  config.dhcp = eeprom[16];
+  config.isDayLightSaving = eeprom[17];
+  config.Update_Time_Via_NTP_Every = legacyReadLong(18);
+  config.timeZone = legacyReadLong(22);
+  memcpy(config.IP, eeprom + 32, 4);
+  memcpy(config.Netmask, eeprom + 36, 4);
+  memcpy(config.Gateway, eeprom + 40, 4);
+  legacyReadString(64, config.ssid, sizeof(config.ssid));
+  legacyReadString(96, config.password, sizeof(config.password));
+  legacyReadString(128, config.ntpServerName, sizeof(config.ntpServerName));
+  legacyReadString(160, config.DeviceName, sizeof(config.DeviceName));
+  legacyReadString(192, config.OTApwd, sizeof(config.OTApwd));
+  legacyReadString(224, config.mqtt_server, sizeof(config.mqtt_server));
+  legacyReadString(256, config.mqtt_port, sizeof(config.mqtt_port));
+  legacyReadString(288, config.mqtt_username, sizeof(config.mqtt_username));
+  legacyReadString(320, config.mqtt_password, sizeof(config.mqtt_password));
+  legacyReadString(352, config.mqtt_prefix, sizeof(config.mqtt_prefix));
+  config.temp_deadband = legacyReadLong(384);
+  config.temp_heartbeat = legacyReadLong(388);
+  legacyReadString(392, config.mqtt_groups, sizeof(config.mqtt_groups), 64);
+  memcpy(config.mqtt_fingerprint, eeprom + 456, 20);
+  config.mqtt_tls = (1 == eeprom[476]); // 0xFF on older layouts
+  config.wifi_scan_ttl = legacyReadLong(477);
+  config.capture_flash = (1 == eeprom[481]);
+  memcpy(config.syslog_server, eeprom + 482, 4);
+  config.syslog_port = legacyReadLong(486);
+  configSanitize();
+  return true;
+}
 
-    WriteStringToEEPROM(64, config.ssid);
-    WriteStringToEEPROM(96, config.password);
-    WriteStringToEEPROM(128, config.ntpServerName);
-    WriteStringToEEPROM(160, config.DeviceName);
-    WriteStringToEEPROM(192, config.OTApwd);
-    WriteStringToEEPROM(224, config.mqtt_server);
-    WriteStringToEEPROM(256, config.mqtt_port);
-    WriteStringToEEPROM(288, config.mqtt_username);
-    WriteStringToEEPROM(320, config.mqtt_password);
-    WriteStringToEEPROM(352, config.mqtt_prefix);
-    EEPROM.commit();
+void WriteConfig()
+{
+  config.magic = CONFIG_MAGIC;
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(strConfig);
+  config.crc = configCrc((const uint8_t*)&config, sizeof(strConfig));
+  memcpy(EEPROM.getDataPtr(), &config, sizeof(strConfig));
+  EEPROM.commit();
+}
 
+boolean ReadConfig()
+{
+  const uint8_t* eeprom = EEPROM.getConstDataPtr();
+  strConfig header;
+  memcpy(&header, eeprom, CONFIG_HEADER_SIZE);
+  if (CONFIG_MAGIC == header.magic && CONFIG_VERSION == header.version &&
+      header.size > CONFIG_HEADER_SIZE && header.size <= CONFIG_EEPROM_SIZE &&
+      configCrc(eeprom, header.size) == header.crc)
+  {
+    // a shorter blob is from an older firmware, its missing fields are sanitized below
+    memset(&config, 0, sizeof(config));
+    memcpy(&config, eeprom, std::min<size_t>(header.size, sizeof(strConfig)));
+    config.ssid[sizeof(config.ssid) - 1] = 0;
+    config.password[sizeof(config.password) - 1] = 0;
+    config.ntpServerName[sizeof(config.ntpServerName) - 1] = 0;
+    config.DeviceName[sizeof(config.DeviceName) - 1] = 0;
+    config.OTApwd[sizeof(config.OTApwd) - 1] = 0;
+    config.mqtt_server[sizeof(config.mqtt_server) - 1] = 0;
+    config.mqtt_port[sizeof(config.mqtt_port) - 1] = 0;
+    config.mqtt_username[sizeof(config.mqtt_username) - 1] = 0;
+    config.mqtt_password[sizeof(config.mqtt_password) - 1] = 0;
+    config.mqtt_prefix[sizeof(config.mqtt_prefix) - 1] = 0;
+    config.mqtt_groups[sizeof(config.mqtt_groups) - 1] = 0;
+    configSanitize();
+    return true;
   }
 
-  boolean ReadConfig()
+  if (ReadLegacyConfig())
   {
-    if (EEPROM.read(0) == 'C' && EEPROM.read(1) == 'F'  && EEPROM.read(2) == 'G' )
-    {
-      config.dhcp = 	EEPROM.read(16);
-      config.isDayLightSaving = EEPROM.read(17);
-      config.Update_Time_Via_NTP_Every = EEPROMReadlong(18); // 4 Byte
-      config.timeZone = EEPROMReadlong(22); // 4 Byte
-      config.IP[0] = EEPROM.read(32);
-      config.IP[1] = EEPROM.read(33);
-      config.IP[2] = EEPROM.read(34);
-      config.IP[3] = EEPROM.read(35);
-      config.Netmask[0] = EEPROM.read(36);
-      config.Netmask[1] = EEPROM.read(37);
-      config.Netmask[2] = EEPROM.read(38);
-      config.Netmask[3] = EEPROM.read(39);
-      config.Gateway[0] = EEPROM.read(40);
-      config.Gateway[1] = EEPROM.read(41);
-      config.Gateway[2] = EEPROM.read(42);
-      config.Gateway[3] = EEPROM.read(43);
-      config.ssid = ReadStringFromEEPROM(64);
-      config.password = ReadStringFromEEPROM(96);
-      config.ntpServerName = ReadStringFromEEPROM(128);
-      config.DeviceName = ReadStringFromEEPROM(160);
-      config.OTApwd = ReadStringFromEEPROM(192);
-      config.mqtt_server = ReadStringFromEEPROM(224);
-      config.mqtt_port = ReadStringFromEEPROM(256);
-      config.mqtt_username = ReadStringFromEEPROM(288);
-      config.mqtt_password = ReadStringFromEEPROM(320);
-      config.mqtt_prefix = ReadStringFromEEPROM(352);
-      return true;
-    }
-    else
-    {
-      return false;
-    }
+    WriteConfig();
+    return true;
   }
+  return false;
+}
 
 void configLoadDefaults(uint16_t ChipId)
 {
-
-  config.ssid = "Thermostat-" + String(ChipId,HEX);       // SSID of access point
-  config.password = "" ;                                  // password of access point
+  memset(&config, 0, sizeof(config));
+  snprintf(config.ssid, sizeof(config.ssid), "Thermostat-%x", ChipId);       // SSID of access point
+  config.password[0] = 0;                                  // password of access point
   config.dhcp = true;
   config.IP[0] = 192; config.IP[1] = 168; config.IP[2] = 1; config.IP[3] = 100;
   config.Netmask[0] = 255; config.Netmask[1] = 255; config.Netmask[2] = 255; config.Netmask[3] = 0;
   config.Gateway[0] = 192; config.Gateway[1] = 168; config.Gateway[2] = 1; config.Gateway[3] = 254;
-  config.ntpServerName = "pool.ntp.org"; 
+  strcpy(config.ntpServerName, "pool.ntp.org");
   config.Update_Time_Via_NTP_Every =  5;
   config.timeZone = 1;
   config.isDayLightSaving = true;
-  config.DeviceName = "Thermostat-" + String(ChipId,HEX);;
-  config.OTApwd = "";
-  config.mqtt_server = "";
-  config.mqtt_port = "";
-  config.mqtt_username = "";
-  config.mqtt_password = "";
-  config.mqtt_prefix = "";
+  snprintf(config.DeviceName, sizeof(config.DeviceName), "Thermostat-%x", ChipId);
+  config.temp_deadband = 20;
+  config.temp_heartbeat = 600;
+  config.mqtt_tls = false;
+  config.wifi_scan_ttl = 60;
+  config.capture_flash = false;
+  config.syslog_port = 0;
   return;
-}
\ No newline at end of file
+}
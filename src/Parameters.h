@@ -1,28 +1,59 @@
 #ifndef PARAMETERS_H
 #define PARAMETERS_H
 
+// Kept in the EEPROM area as one blob, loaded and saved with a single memcpy.
+// A field added later goes to the end; a blob written by an older firmware is
+// shorter (size) and the new fields keep their defaults. Strings are NUL
+// terminated and one byte longer than the longest value.
+#define CONFIG_MAGIC 0x47464354               // "TCFG"
+#define CONFIG_VERSION 1
+#define CONFIG_EEPROM_SIZE 512
+
 struct strConfig {
-  boolean dhcp;                         // 1 Byte - EEPROM 16
-  boolean isDayLightSaving;             // 1 Byte - EEPROM 17
-  long Update_Time_Via_NTP_Every;       // 4 Byte - EEPROM 18
-  long timeZone;                        // 4 Byte - EEPROM 22
-  byte  IP[4];                          // 4 Byte - EEPROM 32
-  byte  Netmask[4];                     // 4 Byte - EEPROM 36
-  byte  Gateway[4];                     // 4 Byte - EEPROM 40
-  String ssid;                          // up to 32 Byte - EEPROM 64
-  String password;                      // up to 32 Byte - EEPROM 96
-  String ntpServerName;                 // up to 32 Byte - EEPROM 128
-  String DeviceName;                    // up to 32 Byte - EEPROM 160
-  String OTApwd;                        // up to 32 Byte - EEPROM 192
-  // Application Settings here... from EEPROM 224 up to 511 (0 - 511)
+  uint32_t magic;                       // CONFIG_MAGIC
+  uint16_t version;                     // CONFIG_VERSION
+  uint16_t size;                        // sizeof(strConfig) of the firmware that wrote it
+  uint32_t crc;                         // CRC32 of the bytes after it, up to size
+
+  boolean dhcp;
+  boolean isDayLightSaving;
+  long Update_Time_Via_NTP_Every;
+  long timeZone;
+  byte  IP[4];
+  byte  Netmask[4];
+  byte  Gateway[4];
+  char ssid[33];
+  char password[33];
+  char ntpServerName[33];
+  char DeviceName[33];
+  char OTApwd[33];
+  // Application Settings here...
   //mqtt data
-  String mqtt_server;                  	// up to 32 Byte - EEPROM 224
-  String mqtt_port;                     // up to 32 Byte - EEPROM 256
-  String mqtt_username;							    // up to 32 Byte - EEPROM 288
-  String mqtt_password;							    // up to 32 Byte - EEPROM 320
-  String mqtt_prefix;							      // up to 32 Byte - EEPROM 352
+  char mqtt_server[33];
+  char mqtt_port[6];
+  char mqtt_username[33];
+  char mqtt_password[33];
+  char mqtt_prefix[33];
+  long temp_deadband;                   // 1/100 degree
+  long temp_heartbeat;                  // seconds
+  char mqtt_groups[64];                 // comma separated zones
+  byte  mqtt_fingerprint[20];           // SHA1 of the broker certificate
+  boolean mqtt_tls;
+  long wifi_scan_ttl;                   // seconds a network scan is reused
+  boolean capture_flash;                // UART frames and events to the flash capture ring
+  byte  syslog_server[4];
+  long syslog_port;                     // 0 = no syslog
 };
 
+// parts of the config a change affects, see ESPBASE::setConfigChangedCallback
+#define CONFIG_CHANGED_FILTER   0x01      // temperature deadband and heartbeat
+#define CONFIG_CHANGED_NAME     0x02      // device name: hostname, mDNS, MQTT client id and topics
+#define CONFIG_CHANGED_PASSWORD 0x04      // admin password
+#define CONFIG_CHANGED_MQTT     0x08      // broker, credentials, prefix, groups
+#define CONFIG_CHANGED_NTP      0x10      // server, timezone, daylight saving
+#define CONFIG_CHANGED_CAPTURE  0x20      // flash capture on or off
+#define CONFIG_CHANGED_SYSLOG   0x40      // syslog server and port
+
 extern strConfig config;
 extern void WriteConfig();
 extern boolean ReadConfig();
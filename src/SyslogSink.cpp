@@ -0,0 +1,86 @@
+#include <ESP8266WiFi.h>
+#include <NTPClientLib.h>
+#include <TimeLib.h>
+#include "SyslogSink.h"
+
+void SyslogSink::begin(IPAddress s, uint16_t p, const char* name)
+{
+	if (0 == port)
+		started = false;	// what the ring dropped while it was off is not a loss
+	server = s;
+	port = p;
+	strncpy(hostname, name && *name ? name : "-", sizeof(hostname) - 1);
+	hostname[sizeof(hostname) - 1] = 0;
+	// spaces would end the HOSTNAME field
+	for (char* c = hostname; *c; ++c)
+	{
+		if (*c <= ' ' || *c > '~')
+			*c = '_';
+	}
+}
+
+// RFC 5424 severities
+static uint8_t severity(uint8_t level)
+{
+	switch (level)
+	{
+	case LOG_LEVEL_ERROR:
+		return 3;
+	case LOG_LEVEL_WARN:
+		return 4;
+	case LOG_LEVEL_INFO:
+		return 6;
+	case LOG_LEVEL_NONE:
+		return 5;	// notice, the replies to console commands
+	default:
+		return 7;
+	}
+}
+
+void SyslogSink::send(const Log::Line& line)
+{
+	char timestamp[32] = "-";
+	if (timeNotSet != timeStatus())
+	{
+		// TimeLib keeps local time
+		int offset = NTP.getTimeZone() * 60 + NTP.getTimeZoneMinutes() + (NTP.isSummerTime() ? 60 : 0);
+		time_t t = now() - (millis() - line.time) / 1000;
+		snprintf(timestamp, sizeof(timestamp), "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d", year(t), month(t), day(t), hour(t),
+		         minute(t), second(t), offset < 0 ? '-' : '+', abs(offset) / 60, abs(offset) % 60);
+	}
+	char frameText[LOG_FRAME_TEXT_SIZE];
+	const char* text = Log::KIND_TEXT == line.kind ? line.text : Log::formatFrame(line, frameText);
+
+	int len = snprintf(message, sizeof(message), "<%u>1 %s %s thermostat - %s [meta sequenceId=\"%u\" sysUpTime=\"%u\"] %s",
+	                   SYSLOG_FACILITY * 8 + severity(line.level), timestamp, hostname, Log::getCategoryName(line.category),
+	                   (unsigned)(line.id % 2147483647 + 1), (unsigned)(line.time / 10), text);
+	if (len < 0)
+		return;
+	if (udp.beginPacket(server, port))
+	{
+		udp.write((const uint8_t*)message, std::min<size_t>(len, sizeof(message) - 1));
+		if (udp.endPacket())
+			++sent;
+	}
+}
+
+void SyslogSink::update()
+{
+	if (0 == port || WL_CONNECTED != WiFi.status())
+		return;
+
+	uint32_t end = logger.getNextId();
+	for (int i = 0; i < SYSLOG_SEND_PER_UPDATE && bucket.hasToken(); ++i)
+	{
+		uint32_t next = nextId;
+		Log::Line line;
+		if (!logger.getLine(next, end, line))
+			break;
+		if (started && line.id > nextId)
+			dropped += line.id - nextId;	// the ring moved on before they were shipped
+		started = true;
+		nextId = next;
+		bucket.take();
+		send(line);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef SYSLOGSINK_H
+#define SYSLOGSINK_H
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include "Log.h"
+#include "TokenBucket.h"
+
+// Ships the log to a syslog server over UDP, as RFC 5424 messages:
+//   <134>1 2026-10-19T21:04:05+02:00 Thermostat-1a2b thermostat - mqtt [meta sequenceId="42" sysUpTime="71234"] MQTT connected...
+// with the category as MSGID. The timestamp is "-" until NTP set the clock.
+//
+// The Log ring is the queue: from loop() the lines after the last one shipped
+// are sent one message per datagram (RFC 5426), as fast as the rate allows.
+// Lines the ring dropped before they were shipped are counted.
+#define SYSLOG_MESSAGE_SIZE 480           // every receiver takes this much, longer messages are cut
+#define SYSLOG_RATE 20                    // datagrams per second
+#define SYSLOG_BURST 20
+#define SYSLOG_SEND_PER_UPDATE 4          // leave time for UART and HTTP between sends
+#define SYSLOG_FACILITY 16                // local0
+
+class SyslogSink
+{
+public:
+	// port 0 turns it off; the lines already in the log are shipped as well
+	void begin(IPAddress server, uint16_t port, const char* hostname);
+	// formats and sends, call from loop()
+	void update();
+
+	bool isActive() const { return port != 0; }
+	uint32_t getSent() const { return sent; }
+	uint32_t getDropped() const { return dropped; }
+
+private:
+	void send(const Log::Line& line);
+
+	WiFiUDP udp;
+	IPAddress server;
+	uint16_t port = 0;
+	char hostname[33] = "-";
+	TokenBucket bucket{SYSLOG_RATE, SYSLOG_BURST};
+
+	uint32_t nextId = 0;				// first log line not sent yet
+	bool started = false;
+	char message[SYSLOG_MESSAGE_SIZE];
+
+	uint32_t sent = 0;					// datagrams
+	uint32_t dropped = 0;				// log lines
+};
+#endif
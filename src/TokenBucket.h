@@ -0,0 +1,43 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+#include <Arduino.h>
+
+class TokenBucket
+{
+public:
+	TokenBucket(float ratePerSecond = 1.f, float burst = 1.f)
+	{
+		setRate(ratePerSecond, burst);
+	}
+
+	void setRate(float ratePerSecond, float b)
+	{
+		rate = ratePerSecond / 1000.f;
+		burst = b;
+		tokens = b;
+	}
+
+	bool hasToken()
+	{
+		refill();
+		return tokens >= 1.f;
+	}
+	void take()
+	{
+		tokens -= 1.f;
+	}
+
+private:
+	void refill()
+	{
+		uint32_t now = millis();
+		tokens = std::min(burst, tokens + (now - lastRefill) * rate);
+		lastRefill = now;
+	}
+
+	float rate;		// tokens per ms
+	float burst;
+	float tokens;
+	uint32_t lastRefill = 0;
+};
+#endif
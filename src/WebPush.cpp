@@ -0,0 +1,173 @@
+#include "WebPush.h"
+
+// appends s JSON escaped, stops at the end of the buffer
+static size_t appendEscaped(char* buffer, size_t pos, size_t size, const char* s)
+{
+	for (; *s && pos + 2 < size; ++s)
+	{
+		char c = *s;
+		if ('"' == c || '\\' == c)
+		{
+			buffer[pos++] = '\\';
+			buffer[pos++] = c;
+		}
+		else if ((uint8_t)c >= 0x20)
+			buffer[pos++] = c;
+	}
+	buffer[pos] = 0;
+	return pos;
+}
+
+void WebPush::begin()
+{
+	ws.onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+		onEvent(client, type, arg, data, len);
+	});
+}
+
+void WebPush::onEvent(AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len)
+{
+	if (WS_EVT_CONNECT == type)
+	{
+		Client* filter = findClient(0);
+		if (!filter)
+		{
+			client->close(1013, "Too many clients");
+			return;
+		}
+		filter->id = client->id();
+		filter->fields = C17GH3State::FIELDS_ALL;
+		filter->log = false;
+	}
+	else if (WS_EVT_DISCONNECT == type)
+	{
+		Client* filter = findClient(client->id());
+		if (filter)
+			filter->id = 0;
+	}
+	else if (WS_EVT_DATA == type)
+	{
+		// filter commands are short, only single frame text messages are accepted
+		AwsFrameInfo* info = (AwsFrameInfo*)arg;
+		Client* filter = findClient(client->id());
+		if (filter && info->final && 0 == info->index && info->len == len && WS_TEXT == info->opcode)
+			setFilter(*filter, (const char*)data, len);
+	}
+}
+
+void WebPush::setFilter(Client& filter, const char* command, size_t len)
+{
+	if (len >= 5 && !strncmp(command, "log=", 4))
+	{
+		filter.log = ('1' == command[4]);
+	}
+	else if (len >= 7 && !strncmp(command, "fields=", 7))
+	{
+		filter.fields = 0;
+		size_t start = 7;
+		while (start < len)
+		{
+			size_t end = start;
+			while (end < len && ',' != command[end])
+				++end;
+			size_t n = end - start;
+			if (1 == n && '*' == command[start])
+				filter.fields = C17GH3State::FIELDS_ALL;
+			for (int f = 0; f < C17GH3State::FIELD_COUNT; ++f)
+			{
+				const char* name = C17GH3State::getFieldName((C17GH3State::Field)f);
+				if (strlen(name) == n && !strncmp(name, command + start, n))
+					filter.fields |= C17GH3State::fieldMask((C17GH3State::Field)f);
+			}
+			start = end + 1;
+		}
+	}
+}
+
+WebPush::Client* WebPush::findClient(uint32_t id)
+{
+	for (Client& c : clients)
+	{
+		if (c.id == id)
+			return &c;
+	}
+	return nullptr;
+}
+
+template <typename Accept>
+void WebPush::send(const char* text, size_t len, Accept accept)
+{
+	AsyncWebSocketMessageBuffer* buffer = nullptr;
+	for (Client& c : clients)
+	{
+		if (0 == c.id || !accept(c))
+			continue;
+		AsyncWebSocketClient* client = ws.client(c.id);
+		if (!client || WS_CONNECTED != client->status())
+			continue;
+		if (client->queueIsFull())
+		{
+			// never wait for a slow reader
+			client->close(1008, "Too slow");
+			++closedCount;
+			continue;
+		}
+		if (!buffer)
+		{
+			buffer = ws.makeBuffer(len);
+			if (!buffer)
+				return;
+			memcpy(buffer->get(), text, len);
+			buffer->lock();
+		}
+		client->text(buffer);
+	}
+	if (buffer)
+	{
+		buffer->unlock();
+		ws._cleanBuffers();
+	}
+}
+
+void WebPush::pushFields(const C17GH3State& state, uint32_t fields)
+{
+	uint32_t wanted = 0;
+	for (const Client& c : clients)
+	{
+		if (c.id)
+			wanted |= c.fields;
+	}
+	fields &= wanted;
+
+	char text[WEB_PUSH_MAX_MESSAGE];
+	for (int f = 0; fields; ++f)
+	{
+		uint32_t mask = C17GH3State::fieldMask((C17GH3State::Field)f);
+		if (!(fields & mask))
+			continue;
+		fields &= ~mask;
+		size_t len = snprintf(text, sizeof(text), "{\"field\":\"%s\",\"value\":\"", C17GH3State::getFieldName((C17GH3State::Field)f));
+		len = appendEscaped(text, len, sizeof(text) - 2, state.getFieldValue((C17GH3State::Field)f).c_str());
+		text[len++] = '"';
+		text[len++] = '}';
+		send(text, len, [mask](const Client& c) { return 0 != (c.fields & mask); });
+	}
+}
+
+void WebPush::pushLogLine(const Log::Line& line)
+{
+	bool wanted = false;
+	for (const Client& c : clients)
+		wanted |= (c.id && c.log);
+	if (!wanted)
+		return;
+
+	char frameText[LOG_FRAME_TEXT_SIZE];
+	const char* lineText = Log::KIND_TEXT == line.kind ? line.text : Log::formatFrame(line, frameText);
+	char text[WEB_PUSH_MAX_MESSAGE];
+	size_t len = snprintf(text, sizeof(text), "{\"log\":%u,\"line\":\"", (unsigned)line.id);
+	len = appendEscaped(text, len, sizeof(text) - 2, lineText);
+	text[len++] = '"';
+	text[len++] = '}';
+	send(text, len, [](const Client& c) { return c.log; });
+}
@@ -0,0 +1,52 @@
+#ifndef WEBPUSH_H
+#define WEBPUSH_H
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "C17GH3.h"
+#include "Log.h"
+
+#define WEB_PUSH_MAX_CLIENTS 3            // every client holds a TCP socket
+#define WEB_PUSH_MAX_MESSAGE 256          // longer log lines are cut
+
+// Pushes state field changes and log lines to WebSocket clients.
+// Each event is formatted once into a shared buffer that all interested
+// clients reference. A client whose send queue is full is disconnected.
+//
+// Clients send "fields=<name>,<name>..." (MQTT topic names, "*" for all,
+// empty for none) and "log=1" / "log=0" to choose what they receive.
+// New clients get every field and no log lines.
+class WebPush
+{
+public:
+	WebPush(AsyncWebSocket& ws) : ws(ws) {}
+
+	void begin();
+	void pushFields(const C17GH3State& state, uint32_t fields);
+	// frames are only formatted when a client wants log lines
+	void pushLogLine(const Log::Line& line);
+
+	uint32_t getClosedCount() const
+	{
+		return closedCount;
+	}
+
+private:
+	struct Client
+	{
+		uint32_t id;
+		uint32_t fields;
+		bool log;
+	};
+
+	void onEvent(AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len);
+	void setFilter(Client& filter, const char* command, size_t len);
+	Client* findClient(uint32_t id);
+	// sends text to every client the predicate accepts
+	template <typename Accept>
+	void send(const char* text, size_t len, Accept accept);
+
+	AsyncWebSocket& ws;
+	Client clients[WEB_PUSH_MAX_CLIENTS] = {};
+	uint32_t closedCount = 0;          // clients dropped for not keeping up
+};
+#endif
@@ -0,0 +1,47 @@
+#include "WifiScan.h"
+#include <ESP8266WiFi.h>
+
+void WifiScan::refresh(uint32_t maxAge)
+{
+	if (scanning || (valid && millis() - lastScan < maxAge))
+		return;
+	WiFi.scanNetworks(true);
+	scanning = true;
+}
+
+void WifiScan::update()
+{
+	if (!scanning)
+		return;
+	int n = WiFi.scanComplete();
+	if (WIFI_SCAN_RUNNING == n)
+		return;
+	scanning = false;
+	if (n < 0)
+		return;
+
+	// insertion by signal strength, weakest ones fall off the end
+	count = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		int32_t rssi = WiFi.RSSI(i);
+		uint8_t pos = count;
+		while (pos > 0 && networks[pos - 1].rssi < rssi)
+			--pos;
+		if (pos >= MAX_NETWORKS)
+			continue;
+		uint8_t last = std::min<uint8_t>(count, MAX_NETWORKS - 1);
+		memmove(&networks[pos + 1], &networks[pos], (last - pos) * sizeof(Network));
+		strncpy(networks[pos].ssid, WiFi.SSID(i).c_str(), sizeof(networks[pos].ssid) - 1);
+		networks[pos].ssid[sizeof(networks[pos].ssid) - 1] = 0;
+		networks[pos].rssi = rssi;
+		networks[pos].encrypted = (WiFi.encryptionType(i) != ENC_TYPE_NONE);
+		if (count < MAX_NETWORKS)
+			++count;
+	}
+	WiFi.scanDelete();
+
+	valid = true;
+	lastScan = millis();
+	++generation;
+}
@@ -0,0 +1,54 @@
+#ifndef WIFISCAN_H
+#define WIFISCAN_H
+#include <Arduino.h>
+
+// Results of the last background network scan. A scan is only started when
+// the cached results are older than the requested age, readers never wait for it.
+class WifiScan
+{
+public:
+	static const uint8_t MAX_NETWORKS = 16;	// strongest ones are kept
+
+	struct Network
+	{
+		char ssid[33];
+		int32_t rssi;
+		bool encrypted;
+	};
+
+	// start a background scan if the results are older than maxAge ms
+	void refresh(uint32_t maxAge);
+	// collect the results of a finished scan, call from loop()
+	void update();
+
+	bool isScanning() const
+	{
+		return scanning;
+	}
+	bool hasResults() const
+	{
+		return valid;
+	}
+	uint8_t getCount() const
+	{
+		return count;
+	}
+	const Network& getNetwork(uint8_t i) const
+	{
+		return networks[i];
+	}
+	// changes whenever new results replace the cached ones
+	uint32_t getGeneration() const
+	{
+		return generation;
+	}
+
+private:
+	Network networks[MAX_NETWORKS];
+	uint8_t count = 0;
+	bool valid = false;
+	bool scanning = false;
+	uint32_t lastScan = 0;
+	uint32_t generation = 0;
+};
+#endif
@@ -2,8 +2,17 @@
 #define WIFITOOLS_H 
 
 
-ESP8266WebServer server(80);							// The Webserver
-ESP8266HTTPUpdateServer updateServer();
+AsyncWebServer server(80);							// The Webserver
+AsyncWebSocket ws("/ws");							// state and log push
+WebPush webPush(ws);
+WifiScan wifiScan;
+CaptureRing capture;
+SyslogSink syslogSink;
+
+// request handlers run outside loop(), flash writes and restarts are left to ESPBASE::handle()
+bool httpConfigSavePending = false;
+uint8_t httpConfigChanged = 0;            // CONFIG_CHANGED_* to apply without a restart
+uint32_t httpRestartAt = 0;
 
 /*
 **
@@ -11,7 +20,7 @@ ESP8266HTTPUpdateServer updateServer();
 **
 */
 void ConfigureWifi(){
-  WiFi.begin (config.ssid.c_str(), config.password.c_str());
+  WiFi.begin (config.ssid, config.password);
 
   while (WiFi.status() != WL_CONNECTED) {
     delay(500);
@@ -39,6 +48,49 @@ String GetAPMacAddress(){
   return  String(macStr);
 }
 
+// digest authentication when an admin password is set, false if the request got a challenge instead
+bool httpAuthenticate(AsyncWebServerRequest* request){
+  if (config.OTApwd[0] && !request->authenticate("admin", config.OTApwd)) {
+    request->requestAuthentication();
+    return false;
+  }
+  return true;
+}
+
+// gzipped PROGMEM asset from Assets_gz.h, 304 when the browser already has this content
+void sendGzipAsset(AsyncWebServerRequest* request, const uint8_t* data, size_t length, const char* etag, const char* contentType, const char* cacheControl){
+  AsyncWebServerResponse* response;
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) {
+    response = request->beginResponse(304);
+  }
+  else {
+    response = request->beginResponse_P(200, contentType, data, length);
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", cacheControl);
+  request->send(response);
+}
+
+#define HTTP_BODY_MAX 1536                  // JSON bodies of the /api/ POST requests
+
+// body handler collecting the request body into _tempObject, NUL terminated; left null when too large
+void httpCollectBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total){
+  if (total > HTTP_BODY_MAX)
+    return;
+  if (0 == index) {
+    request->_tempObject = malloc(total + 1);
+    if (request->_tempObject)
+      ((char*)request->_tempObject)[total] = 0;
+  }
+  if (request->_tempObject && index + len <= total)
+    memcpy((char*)request->_tempObject + index, data, len);
+}
+
+#define CACHE_PAGE "no-cache"               // pages are revalidated, a 304 costs a few bytes
+#define CACHE_STATIC "max-age=86400"        // style and script
+#define SEND_GZIP_ASSET(request, name, contentType, cacheControl) sendGzipAsset(request, name##_gz, sizeof(name##_gz), name##_etag, contentType, cacheControl)
+
 uint16_t getChipId(){
   uint16_t id;
   id = ESP.getChipId();
@@ -1,38 +1,122 @@
-#define MQTT_MAX_PACKET_SIZE 1024  //Setting for JSON-MQTT
-
 #include <Arduino.h>
 #include "ESPBase.h"
-#include <PubSubClient.h>
+#if MQTT_BEARSSL
+#include "MqttSecureClient.h"
+#else
+#include <AsyncMqttClient.h>
+typedef AsyncMqttClientMessageProperties MqttMessageProperties;
+typedef AsyncMqttClientDisconnectReason MqttDisconnectReason;
+#endif
 #include <ArduinoJson.h>
 #include <NTPClientLib.h>
 
 #include "C17GH3.h"
+#include "OfflineBuffer.h"
+#include "TokenBucket.h"
+
+#define MQTT_MAX_PAYLOAD_SIZE 1024       // Setting for JSON-MQTT
+#define MQTT_CONNECT_TIMEOUT 10000       // give up on a connect attempt after 10s
+#define MQTT_RETRY_DELAY_MIN 2000
+#define MQTT_RETRY_DELAY_MAX 60000
+#define MQTT_TLS_MIN_HEAP 24000          // largest free block needed before starting a TLS handshake
+#define MQTT_DEDUP_SIZE 8                // recently received commands remembered for QoS 1 redeliveries
+#define MQTT_INBOX_SIZE 2048             // received messages waiting for loop()
+#define MQTT_COMMAND_RATE 1              // per command topic: 1 per second, bursts of 3
+#define MQTT_COMMAND_BURST 3
+#define MQTT_COMMAND_GLOBAL_RATE 3       // all commands together, each one is a UART frame
+#define MQTT_COMMAND_GLOBAL_BURST 6
+#define MQTT_PUBLISH_PER_LOOP 4          // leave time for UART and HTTP between publishes
+#define MQTT_PUBLISH_RETRY_DELAY 50      // back off when the client is out of buffer space
+#define DIAGNOSTICS_INTERVAL 60000
+#define OFFLINE_FLUSH_INTERVAL 100        // publish one recorded offline change every 100ms after reconnect
+#define LOOP_STALL_LOG_MS 100            // log every loop() iteration taking longer than this
 
 ESPBASE Esp;
 C17GH3State state;
 Log logger;
 
-static void mqttCallback(char* top, byte* pay, unsigned int length);
+static void mqttCallback(const char* topic, const char* payload);
+static void mqttSetup();
+static void mqttConfigure();
+static void mqttReconfigure();
+static void ntpConfigure();
+static void mqttForEachGroup(std::function<void(const String&)> fn);
 static void mqttPublish();
+static void mqttSubmitCommand(int command, const String& payload);
 
-WiFiClient espClient;
-PubSubClient mqttClient(espClient);
+#if MQTT_BEARSSL
+MqttSecureClient mqttClient;
+#else
+AsyncMqttClient mqttClient;
+#endif
 NTPSyncEvent_t ntpEvent; 				// Last triggered event
 int reconnect = 0;
 
+enum MqttConnectionState
+{
+	MQTT_STATE_DISCONNECTED,
+	MQTT_STATE_CONNECTING,
+	MQTT_STATE_CONNECTED
+};
+
+MqttConnectionState mqttState = MQTT_STATE_DISCONNECTED;
+uint32_t mqttNextConnectAttempt = 0;
+uint32_t mqttConnectStarted = 0;
+uint32_t mqttConnectMinHeap = 0;         // heap low-water mark of the current connect attempt
+uint32_t mqttRetryDelay = MQTT_RETRY_DELAY_MIN;
+uint32_t mqttPendingFields = 0;          // outbound queue, one bit per C17GH3State::Field
+bool mqttPendingOnline = false;
+uint32_t mqttNextPublish = 0;
+uint32_t mqttPublishedCount = 0;
+uint32_t mqttRetryCount = 0;             // publishes refused by the client and tried again
+uint32_t mqttCoalescedCount = 0;         // changes folded into a pending publish, which sends the newest value
+uint32_t diagnosticsNextPublish = 0;
+
+// inbound commands, one slot per C17GH3State::Field plus the batched set topic at FIELD_COUNT
+#define MQTT_COMMAND_SET C17GH3State::FIELD_COUNT
+TokenBucket mqttCommandBuckets[C17GH3State::FIELD_COUNT + 1];
+TokenBucket mqttCommandGlobalBucket(MQTT_COMMAND_GLOBAL_RATE, MQTT_COMMAND_GLOBAL_BURST);
+String mqttPendingCommands[C17GH3State::FIELD_COUNT + 1];	// latest throttled payload, empty if none
+uint32_t mqttThrottledCount = 0;
+uint32_t mqttMergedCount = 0;         // throttled commands replaced or merged by a newer one
+uint32_t mqttInboxDroppedCount = 0;
+
+// the client keeps the pointers, so these have to live as long as the client
+String mqttClientId;
+String mqttWillTopic;
+String mqttServer;
+String mqttUsername;
+String mqttPassword;
+// the persistent session keeps these on the broker, removed before the topics change
+String mqttSubscriptions;				// topic filters, one per line
+
+// assembly buffer for payloads delivered in several parts
+char mqttRxBuffer[MQTT_MAX_PAYLOAD_SIZE];
+uint32_t mqttRecentMessages[MQTT_DEDUP_SIZE] = {0};
+uint8_t mqttRecentMessageIdx = 0;
+// the network callbacks only queue, commands reach the UART from loop(): topic and payload, NUL terminated, one after the other
+char mqttInbox[MQTT_INBOX_SIZE];
+size_t mqttInboxLen = 0;
+
+// schedules are not recorded, their current value is republished on reconnect anyway
+OfflineBuffer offlineBuffer(C17GH3State::FIELD_SCHEDULE1,
+	C17GH3State::fieldMask(C17GH3State::FIELD_INTERNAL_TEMP) | C17GH3State::fieldMask(C17GH3State::FIELD_EXTERNAL_TEMP));
+uint32_t offlineNextFlush = 0;
+
+uint32_t loopLastMicros = 0;
+uint32_t loopMaxMicros = 0;              // since the last diagnostics publish
+
 void setup()
 {
 	Esp.initialize(&state);
 
  	Serial.begin(9600);
 
-	String name = config.DeviceName;
-
-	state.setWifiConfigCallback([name]() {
-		logger.addLine("Configuration portal opened");
+	state.setWifiConfigCallback([]() {
+		LOG_INFO(WIFI, "Configuration portal opened");
     	WiFi.mode(WIFI_AP);
-    	WiFi.softAP(name);
-		logger.addLine("Configuration portal closed");
+    	WiFi.softAP(config.DeviceName);
+		LOG_INFO(WIFI, "Configuration portal closed");
     });
 
 	MDNS.begin(config.DeviceName);
@@ -40,148 +124,571 @@ void setup()
 
 	NTP.onNTPSyncEvent ([](NTPSyncEvent_t event) {
  		if (event == timeSyncd) {
+			 LOG_DEBUG(NTP, "NTP synchronized");
 			 state.setTime();
         }
+		else
+			LOG_WARN(NTP, "NTP sync failed: %d", (int)event);
     });
 
     NTP.setInterval (63);
     NTP.setNTPTimeout (1500);
-    NTP.begin (config.ntpServerName.c_str(), config.timeZone / 10, config.isDayLightSaving,  0);
+    NTP.begin (config.ntpServerName, config.timeZone / 10, config.isDayLightSaving,  0);
+
+	state.setTemperatureFilter(config.temp_deadband / 100.f, config.temp_heartbeat * 1000);
 
 	//Starting MQTT Client
-	mqttClient.setServer(config.mqtt_server.c_str(), config.mqtt_port.toInt());
-	mqttClient.setCallback(mqttCallback);
+	mqttSetup();
+
+	// saved from the web interface, only WiFi and IP changes restart
+	Esp.setConfigChangedCallback([](uint8_t changed) {
+		if (changed & CONFIG_CHANGED_FILTER)
+			state.setTemperatureFilter(config.temp_deadband / 100.f, config.temp_heartbeat * 1000);
+		if (changed & (CONFIG_CHANGED_MQTT | CONFIG_CHANGED_NAME))
+			mqttReconfigure();
+		if (changed & CONFIG_CHANGED_NTP)
+			ntpConfigure();
+	});
 }
 
-void mqttCallback(char* top, byte* pay, unsigned int length) 
+// the new offsets are used from the next sync on
+void ntpConfigure()
 {
-	char buffer[1024] = {0};
+	NTP.setNtpServerName(config.ntpServerName);
+	NTP.setTimeZone(config.timeZone / 10);
+	NTP.setDayLight(config.isDayLightSaving);
+}
 
-	if (length >= 1024 || length == 0)
-		return; // message too big or null
-	memcpy(buffer, pay, length);
-	String payload(buffer);
+void mqttCallback(const char* top, const char* pay) 
+{
+	String payload(pay);
 	String topic(top);
 
 	if(payload.length() == 0)
 	  return;
-    
-	if(topic.endsWith("/on/set"))
-		state.setPower(payload.toInt());
-	else if(topic.endsWith("/lock/set"))
-		state.setLock(payload.toInt());
-	else if(topic.endsWith("/manual/set"))
-		state.setMode(payload.toInt());
-	else if(topic.endsWith("/temperature_setpoint/set"))
-		state.setSetPointTemp(payload.toFloat());
-	else if(topic.endsWith("/backlight_always_on/set"))
-		state.setBacklightMode(payload.toInt());
-	else if(topic.endsWith("/on_after_powerloss/set"))
-		state.setPowerMode(payload.toInt());	
-	else if(topic.endsWith("/antifreeze/set"))
-		state.setAntifreezeMode(payload.toInt());	
-	else if(topic.endsWith("/sensor_mode/set"))
-		state.setSensorMode((C17GH3MessageSettings2::SensorMode)payload.toInt());	
-	else if(topic.endsWith("/temperature_correction/set"))
-		state.setTempCorrect(payload.toFloat());
-	else if(topic.endsWith("/hysteresis_internal/set"))
-		state.setInternalHysteresis(payload.toFloat());
-	else if(topic.endsWith("/hysteresis_external/set"))
-		state.setExternalHysteresis(payload.toFloat());
-	else if(topic.endsWith("/temperature_limit_external/set"))
-		state.setTemperatureLimit(payload.toFloat());
-	else if(topic.endsWith("/schedule1/set"))
-		state.setSchedule(1, payload);
-	else if(topic.endsWith("/schedule2/set"))
-		state.setSchedule(2, payload);
-	else if(topic.endsWith("/schedule3/set"))
-		state.setSchedule(3, payload);
-	else if(topic.endsWith("/schedule4/set"))
-		state.setSchedule(4, payload);
-	else if(topic.endsWith("/schedule5/set"))
-		state.setSchedule(5, payload);
-	else if(topic.endsWith("/schedule6/set"))
-		state.setSchedule(6, payload);
-	else if(topic.endsWith("/schedule7/set"))
-		state.setSchedule(7, payload);
+
+	// <prefix>/<device>/... or <prefix>/group/<zone>/... of a configured zone
+	String base = String(config.mqtt_prefix) + "/" + config.DeviceName + "/";
+	if (!topic.startsWith(base))
+	{
+		base = "";
+		mqttForEachGroup([&](const String& group) {
+			if (topic.startsWith(group))
+				base = group;
+		});
+		if (base.length() == 0)
+			return; // left over subscription of a zone we are no longer part of
+	}
+
+	String command = topic.substring(base.length());
+	if (command == "set")
+	{
+		mqttSubmitCommand(MQTT_COMMAND_SET, payload);
+		return;
+	}
+	for (int i = 0; i < C17GH3State::FIELD_COUNT; ++i)
+	{
+		if (command == String(C17GH3State::getFieldName((C17GH3State::Field)i)) + "/set")
+		{
+			mqttSubmitCommand(i, payload);
+			return;
+		}
+	}
 }
 
-uint32_t mqttNextConnectAttempt = 0;
+static void mqttApplyCommand(int command, const String& payload)
+{
+	if (MQTT_COMMAND_SET == command)
+		state.setSettings(payload);
+	else
+		state.setFieldValue((C17GH3State::Field)command, payload);
+}
 
-void mqttReconnect() 
+static bool mqttTakeCommandToken(int command)
 {
-	uint32_t now = millis();
-	if (now > mqttNextConnectAttempt)
+	if (!mqttCommandBuckets[command].hasToken() || !mqttCommandGlobalBucket.hasToken())
+		return false;
+	mqttCommandBuckets[command].take();
+	mqttCommandGlobalBucket.take();
+	return true;
+}
+
+// newer fields of a throttled batched set win, the others are kept
+static String mqttMergeSettings(const String& pending, const String& payload)
+{
+	StaticJsonDocument<1024> merged;
+	StaticJsonDocument<512> update;
+	if (deserializeJson(merged, pending) || deserializeJson(update, payload) ||
+	    !merged.is<JsonObject>() || !update.is<JsonObject>())
+		return payload;
+
+	for (JsonPair field : update.as<JsonObject>())
+		merged[field.key().c_str()] = field.value();
+	String json;
+	serializeJson(merged, json);
+	return json;
+}
+
+// a field is throttled in one queue at most, so the replay cannot apply an older value over a newer one
+static void mqttSupersedeCommands(int command, const String& payload)
+{
+	if (MQTT_COMMAND_SET == command)
 	{
-		// Loop until we're reconnected
-		if (!mqttClient.connected())
+		StaticJsonDocument<512> update;
+		if (deserializeJson(update, payload) || !update.is<JsonObject>())
+			return;
+		for (int i = 0; i < C17GH3State::FIELD_COUNT; ++i)
 		{
-			logger.addLine("Attempting MQTT connection...");
-			String prefix = config.mqtt_prefix + "/" + config.DeviceName;
-			// Attempt to connect
-			String lastWill = prefix + "/online";
-			if (mqttClient.connect(config.DeviceName.c_str(), config.mqtt_username.c_str(), config.mqtt_password.c_str(), lastWill.c_str(), 1, true, "offline")) 
-			{
-				logger.addLine("MQTT connected");
-				mqttClient.publish(lastWill.c_str(), "online", true);
-				String topic = prefix + "/+/set";
-				mqttClient.subscribe(topic.c_str());
-			} 
-			else 
+			if (update.containsKey(C17GH3State::getFieldName((C17GH3State::Field)i)))
+				mqttPendingCommands[i] = String();
+		}
+		return;
+	}
+
+	String& pending = mqttPendingCommands[MQTT_COMMAND_SET];
+	if (0 == pending.length())
+		return;
+	StaticJsonDocument<1024> settings;
+	if (deserializeJson(settings, pending) || !settings.is<JsonObject>())
+		return;
+	JsonObject fields = settings.as<JsonObject>();
+	const char* name = C17GH3State::getFieldName((C17GH3State::Field)command);
+	if (!fields.containsKey(name))
+		return;
+	fields.remove(name);
+	pending = String();
+	if (fields.size() > 0)
+		serializeJson(settings, pending);
+}
+
+void mqttSubmitCommand(int command, const String& payload)
+{
+	mqttSupersedeCommands(command, payload);
+	if (mqttPendingCommands[command].length() > 0)
+	{
+		// already throttled, keep only the latest value so it is applied in order
+		++mqttThrottledCount;
+		++mqttMergedCount;
+		if (MQTT_COMMAND_SET == command)
+			mqttPendingCommands[command] = mqttMergeSettings(mqttPendingCommands[command], payload);
+		else
+			mqttPendingCommands[command] = payload;
+		return;
+	}
+
+	if (mqttTakeCommandToken(command))
+	{
+		mqttApplyCommand(command, payload);
+		return;
+	}
+
+	++mqttThrottledCount;
+	mqttPendingCommands[command] = payload;
+}
+
+void mqttApplyPendingCommands()
+{
+	for (int i = 0; i <= MQTT_COMMAND_SET; ++i)
+	{
+		if (0 == mqttPendingCommands[i].length() || !mqttTakeCommandToken(i))
+			continue;
+		mqttApplyCommand(i, mqttPendingCommands[i]);
+		mqttPendingCommands[i] = String();
+	}
+}
+
+// calls fn with "<prefix>/group/<zone>/" for every configured zone
+static void mqttForEachGroup(std::function<void(const String&)> fn)
+{
+	String groups = config.mqtt_groups;
+	int start = 0;
+	while (start < (int)groups.length())
+	{
+		int end = groups.indexOf(',', start);
+		if (end < 0)
+			end = groups.length();
+		String zone = groups.substring(start, end);
+		zone.trim();
+		if (zone.length() > 0)
+			fn(String(config.mqtt_prefix) + "/group/" + zone + "/");
+		start = end + 1;
+	}
+}
+
+static void mqttForEachSubscription(std::function<void(const String&)> fn)
+{
+	int start = 0;
+	for (int end = mqttSubscriptions.indexOf('\n'); end >= 0; end = mqttSubscriptions.indexOf('\n', start))
+	{
+		fn(mqttSubscriptions.substring(start, end));
+		start = end + 1;
+	}
+}
+
+static uint32_t mqttMessageHash(const char* topic, const char* payload, size_t length)
+{
+	// FNV-1a over topic and payload
+	uint32_t hash = 2166136261UL;
+	for (const char* c = topic; *c; ++c)
+		hash = (hash ^ (uint8_t)*c) * 16777619UL;
+	for (size_t i = 0; i < length; ++i)
+		hash = (hash ^ (uint8_t)payload[i]) * 16777619UL;
+	return hash;
+}
+
+void mqttOnMessage(char* topic, char* payload, MqttMessageProperties properties, size_t len, size_t index, size_t total)
+{
+	if (total > MQTT_MAX_PAYLOAD_SIZE || index + len > total)
+		return; // message too big
+
+	memcpy(mqttRxBuffer + index, payload, len);
+	if (index + len < total)
+		return; // wait for the remaining parts
+
+	// with a persistent session the broker redelivers unacknowledged QoS 1 commands
+	uint32_t hash = mqttMessageHash(topic, mqttRxBuffer, total);
+	if (properties.dup)
+	{
+		for (int i = 0; i < MQTT_DEDUP_SIZE; ++i)
+		{
+			if (mqttRecentMessages[i] == hash)
 			{
-				logger.addLine(String("MQTT Connection failed: " + mqttClient.state()));
-				mqttNextConnectAttempt = now + 2000;
+				LOG_DEBUG(MQTT, "MQTT duplicate dropped: %s", topic);
+				return;
 			}
 		}
 	}
+	mqttRecentMessages[mqttRecentMessageIdx] = hash;
+	mqttRecentMessageIdx = (mqttRecentMessageIdx + 1) % MQTT_DEDUP_SIZE;
+
+	size_t topicLen = strlen(topic) + 1;
+	if (0 == total || memchr(mqttRxBuffer, 0, total))
+		return; // empty or not text
+	if (mqttInboxLen + topicLen + total + 1 > sizeof(mqttInbox))
+	{
+		++mqttInboxDroppedCount;
+		return; // loop() is behind, the rate limits would drop it anyway
+	}
+	memcpy(mqttInbox + mqttInboxLen, topic, topicLen);
+	memcpy(mqttInbox + mqttInboxLen + topicLen, mqttRxBuffer, total);
+	mqttInboxLen += topicLen + total;
+	mqttInbox[mqttInboxLen++] = 0;
+}
+
+// the messages queued by mqttOnMessage, in the order they arrived
+void mqttProcessInbox()
+{
+	size_t offset = 0;
+	while (offset < mqttInboxLen)
+	{
+		const char* topic = mqttInbox + offset;
+		const char* payload = topic + strlen(topic) + 1;
+		offset = payload + strlen(payload) + 1 - mqttInbox;
+		mqttCallback(topic, payload);
+	}
+	mqttInboxLen = 0;
+}
+
+void mqttOnConnect(bool sessionPresent)
+{
+	LOG_INFO(MQTT, "MQTT connected in %u ms, heap low-water: %u, session present: %d", (unsigned)(millis() - mqttConnectStarted),
+	         (unsigned)mqttConnectMinHeap, sessionPresent);
+	mqttState = MQTT_STATE_CONNECTED;
+	mqttRetryDelay = MQTT_RETRY_DELAY_MIN;
+	mqttClient.setCleanSession(false);			// after a reconfigure it may have been a clean one
+
+	String prefix = String(config.mqtt_prefix) + "/" + config.DeviceName;
+	mqttSubscriptions = prefix + "/+/set\n" + prefix + "/set\n";
+	mqttForEachGroup([](const String& group) {
+		mqttSubscriptions += group + "+/set\n" + group + "set\n";
+	});
+	mqttForEachSubscription([](const String& topic) {
+		mqttClient.subscribe(topic.c_str(), 1);
+	});
+
+	// the broker may have missed changes while we were away, refresh everything
+	mqttPendingOnline = true;
+	if (state.isFirstQueryDone())
+		mqttPendingFields = C17GH3State::FIELDS_ALL;
+}
+
+void mqttOnDisconnect(MqttDisconnectReason reason)
+{
+	if (MQTT_STATE_DISCONNECTED == mqttState)
+		return;
+
+	if (MQTT_STATE_CONNECTED == mqttState)
+		LOG_WARN(MQTT, "MQTT disconnected: %d", (int)reason);
+	else
+		LOG_WARN(MQTT, "MQTT Connection failed: %d", (int)reason);
+
+	mqttState = MQTT_STATE_DISCONNECTED;
+	offlineBuffer.clearLastValues();
+	mqttNextConnectAttempt = millis() + mqttRetryDelay;
+	mqttRetryDelay = std::min<uint32_t>(mqttRetryDelay * 2, MQTT_RETRY_DELAY_MAX);
+}
+
+// broker, credentials and topics from the config
+void mqttConfigure()
+{
+	mqttClientId = config.DeviceName;
+	mqttWillTopic = String(config.mqtt_prefix) + "/" + config.DeviceName + "/online";
+	mqttServer = config.mqtt_server;
+	mqttUsername = config.mqtt_username;
+	mqttPassword = config.mqtt_password;
+
+	mqttClient.setServer(mqttServer.c_str(), atoi(config.mqtt_port));
+	mqttClient.setClientId(mqttClientId.c_str());
+	if (mqttUsername.length() > 0)
+		mqttClient.setCredentials(mqttUsername.c_str(), mqttPassword.c_str());
+	else
+		mqttClient.setCredentials(nullptr, nullptr);
+	mqttClient.setWill(mqttWillTopic.c_str(), 1, true, "offline");
+}
+
+void mqttSetup()
+{
+	mqttConfigure();
+	// persistent session: commands sent while we reconnect are queued by the broker
+	mqttClient.setCleanSession(false);
+#if MQTT_BEARSSL
+	if (config.mqtt_tls)
+	{
+		// the certificate is pinned by its SHA1 fingerprint, a config from before that was required may have none
+		bool pinned = false;
+		for (uint8_t b : config.mqtt_fingerprint)
+			pinned |= (0 != b);
+		if (!pinned)
+			LOG_WARN(MQTT, "MQTT TLS without a fingerprint, the broker certificate is not verified");
+		mqttClient.setSecure(true, pinned ? config.mqtt_fingerprint : nullptr);
+	}
+#else
+	if (config.mqtt_tls)
+		LOG_ERROR(MQTT, "MQTT TLS requested, but this build has no TLS support");
+#endif
+	for (TokenBucket& bucket : mqttCommandBuckets)
+		bucket.setRate(MQTT_COMMAND_RATE, MQTT_COMMAND_BURST);
+
+	mqttClient.onConnect(mqttOnConnect);
+	mqttClient.onDisconnect(mqttOnDisconnect);
+	mqttClient.onMessage(mqttOnMessage);
+}
+
+// changed broker or topics: drop the connection and connect again with the new config
+void mqttReconfigure()
+{
+	bool connected = (MQTT_STATE_CONNECTED == mqttState);
+	if (connected)
+	{
+		// the session outlives the connection, without this the broker keeps queueing for the old topics;
+		// the packets are sent in order before the disconnect, which does not trigger the will
+		mqttForEachSubscription([](const String& topic) {
+			mqttClient.unsubscribe(topic.c_str());
+		});
+		mqttClient.publish(mqttWillTopic.c_str(), 1, true, "offline");
+		// not a failure, mqttOnDisconnect stays quiet
+		mqttState = MQTT_STATE_DISCONNECTED;
+		offlineBuffer.clearLastValues();
+		mqttClient.disconnect();
+	}
+	else if (MQTT_STATE_CONNECTING == mqttState)
+	{
+		mqttState = MQTT_STATE_DISCONNECTED;
+		offlineBuffer.clearLastValues();
+		mqttClient.disconnect(true);
+	}
+	if (!connected && mqttSubscriptions.length() > 0)
+	{
+		// no chance to unsubscribe, the next connect starts the session over instead
+		mqttClient.setCleanSession(true);
+	}
+	mqttSubscriptions = String();
+	mqttConfigure();
+	LOG_INFO(MQTT, "MQTT reconfigured");
+	// give the old connection time to close, connect() is ignored while it is still up
+	mqttRetryDelay = MQTT_RETRY_DELAY_MIN;
+	mqttNextConnectAttempt = millis() + MQTT_RETRY_DELAY_MIN;
+}
+
+void mqttReconnect() 
+{
+	uint32_t now = millis();
+
+	if (MQTT_STATE_CONNECTING == mqttState)
+	{
+		mqttConnectMinHeap = std::min(mqttConnectMinHeap, ESP.getFreeHeap());
+		if (now - mqttConnectStarted > MQTT_CONNECT_TIMEOUT)
+		{
+			LOG_WARN(MQTT, "MQTT connect timeout");
+			mqttClient.disconnect(true);
+			mqttOnDisconnect(MqttDisconnectReason::TCP_DISCONNECTED);
+		}
+		return;
+	}
+
+	if (MQTT_STATE_DISCONNECTED != mqttState || WiFi.status() != WL_CONNECTED || mqttServer.length() == 0)
+		return;
+
+	if ((int32_t)(now - mqttNextConnectAttempt) >= 0)
+	{
+#if MQTT_BEARSSL
+		// a TLS handshake needs a large contiguous block, don't start one that will fail half way
+		if (config.mqtt_tls && ESP.getMaxFreeBlockSize() < MQTT_TLS_MIN_HEAP)
+		{
+			LOG_WARN(MQTT, "MQTT TLS connect deferred, largest free block: %u", (unsigned)ESP.getMaxFreeBlockSize());
+			mqttNextConnectAttempt = now + MQTT_RETRY_DELAY_MIN;
+			return;
+		}
+#endif
+		// the result arrives in mqttOnConnect / mqttOnDisconnect; AsyncMqttClient returns immediately,
+		// the BearSSL client calls them before connect() returns
+		LOG_DEBUG(MQTT, "Attempting MQTT connection...");
+		mqttState = MQTT_STATE_CONNECTING;
+		mqttConnectStarted = now;
+		mqttConnectMinHeap = ESP.getFreeHeap();
+		mqttClient.connect();
+	}
+}
+
+// false means the client is out of buffer space and publishing pauses for a moment
+static bool mqttSend(const String& topic, uint8_t qos, bool retain, const String& payload)
+{
+	if (0 == mqttClient.publish(topic.c_str(), qos, retain, payload.c_str()))
+	{
+		++mqttRetryCount;
+		mqttNextPublish = millis() + MQTT_PUBLISH_RETRY_DELAY;
+		return false;
+	}
+	++mqttPublishedCount;
+	return true;
+}
+
+static bool mqttCanPublish()
+{
+	return mqttClient.connected() && (int32_t)(millis() - mqttNextPublish) >= 0;
 }
 
 void mqttPublish()
 {
-	if(state.isChanged)
-	{
-		String prefix = config.mqtt_prefix + "/" + config.DeviceName;
-
-		mqttClient.publish(String(prefix + "/online").c_str(), "online", true);
-		mqttClient.publish(String(prefix + "/wifi").c_str(), String(state.getWiFiState()).c_str());
-		mqttClient.publish(String(prefix + "/temperature_setpoint").c_str(), String(state.getSetPointTemp()).c_str(), true);
-		mqttClient.publish(String(prefix + "/lock").c_str(), String(state.getLock()).c_str(), true);
-		mqttClient.publish(String(prefix + "/manual").c_str(), String(state.getMode()).c_str(), true);
-		mqttClient.publish(String(prefix + "/on").c_str(), String(state.getPower()).c_str(), true);
-		mqttClient.publish(String(prefix + "/temperatur_internal").c_str(), String(state.getInternalTemperature()).c_str());
-		mqttClient.publish(String(prefix + "/temperatur_external").c_str(), String(state.getExternalTemperature()).c_str());
-		mqttClient.publish(String(prefix + "/backlight_always_on").c_str(), String(state.getBacklightMode()).c_str(), true);
-		mqttClient.publish(String(prefix + "/on_after_powerloss").c_str(), String(state.getPowerMode()).c_str(), true);
-		mqttClient.publish(String(prefix + "/antifreeze").c_str(), String(state.getAntifreezeMode()).c_str(), true);
-		mqttClient.publish(String(prefix + "/sensor_mode").c_str(), String(state.getSensorMode()).c_str(), true);
-		mqttClient.publish(String(prefix + "/temperature_correction").c_str(), String(state.getTempCorrect()).c_str(), true); 
-		mqttClient.publish(String(prefix + "/hysteresis_internal").c_str(), String(state.getInternalHysteresis()).c_str(), true);
-		mqttClient.publish(String(prefix + "/hysteresis_external").c_str(), String(state.getExternalHysteresis()).c_str(), true);
-		mqttClient.publish(String(prefix + "/temperature_limit_external").c_str(), String(state.getTemperatureLimit()).c_str(), true);
-		
-		mqttClient.publish(String(prefix + "/schedule1").c_str(), state.getSchedule(1).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule2").c_str(), state.getSchedule(2).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule3").c_str(), state.getSchedule(3).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule4").c_str(), state.getSchedule(4).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule5").c_str(), state.getSchedule(5).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule6").c_str(), state.getSchedule(6).c_str(), true);
-		mqttClient.publish(String(prefix + "/schedule7").c_str(), state.getSchedule(7).c_str(), true);
-
-		state.isChanged = false;
+	if (!mqttCanPublish())
+		return;
+
+	String prefix = String(config.mqtt_prefix) + "/" + config.DeviceName;
+	uint8_t budget = MQTT_PUBLISH_PER_LOOP;
+
+	if (mqttPendingOnline)
+	{
+		if (!mqttSend(prefix + "/online", 1, true, "online"))
+			return;
+		mqttPendingOnline = false;
+		--budget;
+	}
+
+	for (int i = 0; i < C17GH3State::FIELD_COUNT && 0 != mqttPendingFields && budget > 0; ++i)
+	{
+		C17GH3State::Field field = (C17GH3State::Field)i;
+		if (0 == (mqttPendingFields & C17GH3State::fieldMask(field)))
+			continue;
+
+		// wifi and the measured temperatures are not retained
+		bool retain = (C17GH3State::FIELD_WIFI != field && C17GH3State::FIELD_INTERNAL_TEMP != field && C17GH3State::FIELD_EXTERNAL_TEMP != field);
+		if (!mqttSend(prefix + "/" + C17GH3State::getFieldName(field), 0, retain, state.getFieldValue(field)))
+			return; // keep the rest queued
+		mqttPendingFields &= ~C17GH3State::fieldMask(field);
+		--budget;
+	}
+}
+
+void mqttPublishDiagnostics()
+{
+	uint32_t millisNow = millis();
+	if (!mqttCanPublish() || 0 != mqttPendingFields || (int32_t)(millisNow - diagnosticsNextPublish) < 0)
+		return;
+
+	String payload = String("{\"published\":") + String(mqttPublishedCount) +
+	                 ",\"retries\":" + String(mqttRetryCount) +
+	                 ",\"coalesced\":" + String(mqttCoalescedCount) +
+	                 ",\"commands_throttled\":" + String(mqttThrottledCount) +
+	                 ",\"commands_merged\":" + String(mqttMergedCount) +
+	                 ",\"commands_inbox_dropped\":" + String(mqttInboxDroppedCount) +
+	                 ",\"offline_merged\":" + String(offlineBuffer.getMergedCount()) +
+	                 ",\"ws_closed_slow\":" + String(webPush.getClosedCount()) +
+	                 ",\"capture_dropped\":" + String(capture.getDropped()) +
+	                 ",\"capture_flush_max_ms\":" + String(capture.getFlushMaxMicros() / 1000) +
+	                 ",\"syslog_sent\":" + String(syslogSink.getSent()) +
+	                 ",\"syslog_dropped\":" + String(syslogSink.getDropped()) +
+	                 ",\"loop_max_ms\":" + String(loopMaxMicros / 1000) +
+	                 ",\"heap\":" + String(ESP.getFreeHeap()) +
+	                 ",\"heap_max_block\":" + String(ESP.getMaxFreeBlockSize()) +
+	                 ",\"heap_fragmentation\":" + String(ESP.getHeapFragmentation()) + "}";
+	if (!mqttSend(String(config.mqtt_prefix) + "/" + config.DeviceName + "/diagnostics", 0, false, payload))
+		return;
+	diagnosticsNextPublish = millisNow + DIAGNOSTICS_INTERVAL;
+	loopMaxMicros = 0;
+}
+
+void offlineRecord(uint32_t fields)
+{
+	for (int i = 0; i < C17GH3State::FIELD_SCHEDULE1; ++i)
+	{
+		C17GH3State::Field field = (C17GH3State::Field)i;
+		if (fields & C17GH3State::fieldMask(field))
+			offlineBuffer.add(field, state.getFieldValue(field).toFloat(), now());
+	}
+}
+
+void offlineFlush()
+{
+	// only once the current state is out, then at a rate the broker and loop() can take
+	if (!mqttCanPublish() || mqttPendingOnline || 0 != mqttPendingFields || offlineBuffer.isEmpty())
+		return;
+
+	uint32_t millisNow = millis();
+	if ((int32_t)(millisNow - offlineNextFlush) < 0)
+		return;
+	offlineNextFlush = millisNow + OFFLINE_FLUSH_INTERVAL;
+
+	const OfflineBuffer::Record& r = offlineBuffer.front();
+	String topic = String(config.mqtt_prefix) + "/" + config.DeviceName + "/history";
+	String payload = String("{\"field\":\"") + C17GH3State::getFieldName((C17GH3State::Field)r.field) +
+	                 "\",\"value\":" + String(r.value) +
+	                 ",\"time\":" + String(r.time) +
+	                 ",\"merged\":" + (r.samples > 1 ? "true" : "false") +
+	                 ",\"samples\":" + String(r.samples) + "}";
+	if (!mqttSend(topic, 1, false, payload))
+		return;
+	offlineBuffer.pop();
+	if (offlineBuffer.isEmpty())
+	{
+		LOG_INFO(MQTT, "Offline buffer flushed, merged records: %u", (unsigned)offlineBuffer.getMergedCount());
+		offlineBuffer.clearMergedCount();
 	}
 }
 
 void loop()
 {
+	uint32_t loopStart = micros();
+	if (0 != loopLastMicros)
+	{
+		uint32_t loopTime = loopStart - loopLastMicros;
+		if (loopTime > LOOP_STALL_LOG_MS * 1000UL)
+			LOG_WARN(SYS, "Loop stall: %u ms", (unsigned)(loopTime / 1000));
+		loopMaxMicros = std::max(loopMaxMicros, loopTime);
+	}
+	loopLastMicros = loopStart;
+
 	ArduinoOTA.handle();
-	server.handleClient();
+	Esp.handle();
 
-	if (!mqttClient.connected()) {
-		mqttReconnect();
-	}
+	mqttReconnect();
 	
 	NTP.getTimeDateString();
 	state.processRx();
+#if MQTT_BEARSSL
+	mqttClient.loop();
+#endif
+	mqttProcessInbox();
+	mqttApplyPendingCommands();
 	if(WiFi.status() != WL_CONNECTED)
 	{
 		WiFi.reconnect();
@@ -197,12 +704,20 @@ void loop()
 		ESP.restart();
 	}
 
-	if(state.isChanged && state.isFirstQueryDone())
+	if(state.isFirstQueryDone())
 	{
-	   mqttPublish();
+		uint32_t changed = state.takeChangedFields();
+		if (MQTT_STATE_CONNECTED != mqttState)
+			offlineRecord(changed);
+		else
+			mqttCoalescedCount += __builtin_popcount(mqttPendingFields & changed);
+		mqttPendingFields |= changed;
+		webPush.pushFields(state, changed);
 	}
+	mqttPublish();
+	offlineFlush();
+	mqttPublishDiagnostics();
 
 	state.processTx();
 	MDNS.update();
-	mqttClient.loop();
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+# Gzips the PROGMEM pages in src/Page_*.h into src/Assets_gz.h.
+# Runs before every PlatformIO build (extra_scripts in platformio.ini),
+# or by hand: python tools/compress_assets.py
+import glob
+import gzip
+import hashlib
+import os
+import re
+
+ASSET = re.compile(r'const char (\w+)\[\] PROGMEM\s*=\s*R"=====\((.*?)\)====="\s*;', re.S)
+# PROGMEM strings that are never sent as a page
+SKIP = set()
+
+
+def generate(project_dir):
+    src = os.path.join(project_dir, "src")
+    out = ["// generated by tools/compress_assets.py from src/Page_*.h, do not edit",
+           "#ifndef ASSETS_GZ_H",
+           "#define ASSETS_GZ_H",
+           ""]
+    for path in sorted(glob.glob(os.path.join(src, "Page_*.h"))):
+        with open(path, encoding="utf-8") as f:
+            text = f.read()
+        for name, content in ASSET.findall(text):
+            if name in SKIP:
+                continue
+            data = gzip.compress(content.encode("utf-8"), 9, mtime=0)
+            etag = hashlib.sha1(data).hexdigest()[:16]
+            out.append("const uint8_t %s_gz[] PROGMEM = {" % name)
+            for i in range(0, len(data), 24):
+                out.append("  " + ",".join("0x%02x" % b for b in data[i:i + 24]) + ",")
+            out.append("};")
+            out.append('const char %s_etag[] = "\\"%s\\"";' % (name, etag))
+            out.append("")
+    out.append("#endif")
+    target = os.path.join(src, "Assets_gz.h")
+    result = "\n".join(out) + "\n"
+    if os.path.exists(target):
+        with open(target, encoding="utf-8") as f:
+            if f.read() == result:
+                return
+    with open(target, "w", encoding="utf-8") as f:
+        f.write(result)
+
+
+try:
+    Import("env")  # noqa: F821
+    generate(env["PROJECT_DIR"])  # noqa: F821
+except NameError:
+    generate(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))